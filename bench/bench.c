@@ -0,0 +1,502 @@
+// benchmarks bake itself: generates projects of a given shape and times
+// cold, no-op and incremental builds of them. results go to stdout as one
+// json object per line, progress to stderr
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ptrace.h>
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define SHAPE_WIDE 0
+#define SHAPE_DEEP 1
+
+typedef struct {
+    // sources over all projects
+    int tus;
+    // libraries and the app that links them
+    int projects;
+    // wide: the app depends on every library, deep: every library on the
+    // one before it and the app on the last one
+    int shape;
+    int headers;
+    // headers every source includes
+    int fanout;
+} bench_shape_t;
+
+typedef struct {
+    bool ok;
+    int64_t wall_ns;
+    // of bake itself, not the compilers, -1 when they were not counted
+    int64_t syscalls;
+    int64_t maxrss;
+} bench_result_t;
+
+static const char *shape_names[] = { "wide", "deep" };
+
+void die(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "bench: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void mkdir_p(const char *dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s", dir);
+    for(char *p = path + 1; *p; p++) {
+        if(*p == '/') {
+            *p = 0;
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    if(mkdir(path, 0755) < 0 && errno != EEXIST) {
+        die("mkdir(%s) failed: %s", path, strerror(errno));
+    }
+}
+
+FILE *create(const char *fmt, ...)
+{
+    char path[PATH_MAX];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(path, PATH_MAX, fmt, args);
+    va_end(args);
+    FILE *f = fopen(path, "w");
+    if(!f) {
+        die("cannot write %s: %s", path, strerror(errno));
+    }
+    return f;
+}
+
+void append(const char *path, const char *line)
+{
+    FILE *f = fopen(path, "a");
+    if(!f) {
+        die("cannot write %s: %s", path, strerror(errno));
+    }
+    fputs(line, f);
+    fclose(f);
+}
+
+// project i of the shape, the last one is the app
+void proj_name(bench_shape_t s, int i, char *out)
+{
+    if(i == s.projects - 1) {
+        snprintf(out, 32, "app");
+    } else {
+        snprintf(out, 32, "p%d", i);
+    }
+}
+
+// writes the project of shape s into dir
+void generate(const char *dir, bench_shape_t s)
+{
+    mkdir_p(dir);
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/include", dir);
+    mkdir_p(path);
+    for(int h = 0; h < s.headers; h++) {
+        FILE *f = create("%s/include/h%d.h", dir, h);
+        fprintf(f, "#pragma once\n#include <stddef.h>\n\n");
+        // something for the compiler to parse
+        for(int k = 0; k < 32; k++) {
+            fprintf(f,
+                    "static inline int h%d_%d(int x)\n{\n    return x * %d + "
+                    "%d;\n}\n",
+                    h, k, k + 1, h);
+        }
+        fclose(f);
+    }
+    FILE *toml = create("%s/bake.toml", dir);
+    fprintf(toml, "[config]\ncc = \"cc\"\nld = \"cc\"\nas = \"cc\"\n\n");
+    fprintf(toml, "[project]\nsub = [");
+    for(int i = 0; i < s.projects; i++) {
+        char name[32];
+        proj_name(s, i, name);
+        fprintf(toml, "%s[\"%s\", \"%s\"]", i ? ", " : "", name, name);
+    }
+    fprintf(toml, "]\next = []\n");
+    int tu = 0;
+    for(int i = 0; i < s.projects; i++) {
+        char name[32];
+        proj_name(s, i, name);
+        bool app = i == s.projects - 1;
+        snprintf(path, PATH_MAX, "%s/%s/src", dir, name);
+        mkdir_p(path);
+        snprintf(path, PATH_MAX, "%s/%s/bin", dir, name);
+        mkdir_p(path);
+        // the sources are split evenly, the app gets what is left
+        int n = app ? s.tus - tu : s.tus / s.projects;
+        for(int k = 0; k < n; k++, tu++) {
+            FILE *f = create("%s/%s/src/s%d.c", dir, name, k);
+            for(int h = 0; h < s.fanout && h < s.headers; h++) {
+                fprintf(f, "#include \"h%d.h\"\n",
+                        (tu * 7 + h * 13) % s.headers);
+            }
+            if(k == 0 && app) {
+                // the app does not call into the libraries, bake puts
+                // ldflags before the objects, so -l would not resolve
+                // anything. deps still orders the links
+                fprintf(f, "int main(void)\n{\n    return 0;\n}\n");
+            } else {
+                fprintf(f, "int %s_f%d(int x)\n{\n    return x + %d;\n}\n",
+                        name, k, k);
+            }
+            fclose(f);
+        }
+        fprintf(toml, "\n[project.%s]\n", name);
+        fprintf(toml, "srcs = \"%s/src\"\nbin = \"%s/bin\"\n", name, name);
+        fprintf(toml, "ccflags = [\"-O1\"]\nincflags = [\"-Iinclude\"]\n");
+        fprintf(toml, "ldflags = [\"\"]\n");
+        if(app) {
+            fprintf(toml, "type = \"exec\"\nbinname = \"app\"\n");
+        } else {
+            fprintf(toml, "type = \"lib\"\nbinname = \"libp%d.a\"\n", i);
+        }
+        fprintf(toml, "deps = [");
+        if(app && s.shape == SHAPE_WIDE) {
+            for(int l = 0; l < s.projects - 1; l++) {
+                fprintf(toml, "%s\"p%d\"", l ? ", " : "", l);
+            }
+        } else if(app && s.projects > 1) {
+            fprintf(toml, "\"p%d\"", s.projects - 2);
+        } else if(s.shape == SHAPE_DEEP && i > 0) {
+            fprintf(toml, "\"p%d\"", i - 1);
+        }
+        fprintf(toml, "]\n");
+    }
+    fprintf(toml, "\n[ext]\n");
+    fclose(toml);
+}
+
+// removes the database and everything in the bin dirs
+void clean(const char *dir, bench_shape_t s)
+{
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/.bake.db", dir);
+    unlink(path);
+    for(int i = 0; i < s.projects; i++) {
+        char name[32];
+        proj_name(s, i, name);
+        snprintf(path, PATH_MAX, "%s/%s/bin", dir, name);
+        DIR *d = opendir(path);
+        if(!d) {
+            continue;
+        }
+        struct dirent *e;
+        while((e = readdir(d))) {
+            char file[PATH_MAX * 2];
+            if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+                continue;
+            }
+            snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+            unlink(file);
+        }
+        closedir(d);
+    }
+}
+
+#ifdef __linux__
+// peak memory of a traced process that is about to exit
+int64_t vm_hwm(pid_t pid)
+{
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    int64_t kib = -1;
+    while(f && fgets(line, sizeof(line), f)) {
+        if(strncmp(line, "VmHWM:", 6) == 0) {
+            kib = strtoll(line + 6, NULL, 10);
+        }
+    }
+    if(f) {
+        fclose(f);
+    }
+    return kib;
+}
+#endif
+
+// runs bake in dir. with count the syscalls and the peak memory of bake
+// itself are taken with ptrace, that slows it down, so the wall time of
+// such a run means nothing
+bench_result_t run_bake(const char *bake, const char *dir, int jobs, bool count)
+{
+    bench_result_t r = { .syscalls = -1, .maxrss = -1 };
+    char jarg[16];
+    snprintf(jarg, sizeof(jarg), "%d", jobs);
+    char *argv[] = { (char *)bake, "--no-server", "-j", jarg, NULL };
+    int64_t start = now_ns();
+    pid_t pid = fork();
+    if(pid < 0) {
+        die("fork failed: %s", strerror(errno));
+    }
+    if(pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        if(chdir(dir) < 0) {
+            _exit(126);
+        }
+#ifdef __linux__
+        if(count) {
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        }
+#endif
+        execvp(bake, argv);
+        _exit(127);
+    }
+    int st;
+#ifdef __linux__
+    if(count) {
+        // stopped at the exec
+        waitpid(pid, &st, 0);
+        ptrace(PTRACE_SETOPTIONS, pid, NULL,
+               PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL);
+        bool insyscall = false;
+        int sig = 0;
+        r.syscalls = 0;
+        for(;;) {
+            ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(intptr_t)sig);
+            if(waitpid(pid, &st, 0) < 0 || WIFEXITED(st) || WIFSIGNALED(st)) {
+                break;
+            }
+            sig = WSTOPSIG(st);
+            if(sig == (SIGTRAP | 0x80)) {
+                if(!insyscall) {
+                    r.syscalls++;
+                }
+                insyscall = !insyscall;
+                sig = 0;
+            } else if(st >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+                r.maxrss = vm_hwm(pid);
+                sig = 0;
+            } else if(sig == SIGTRAP) {
+                sig = 0;
+            }
+        }
+        r.ok = WIFEXITED(st) && WEXITSTATUS(st) == 0;
+        return r;
+    }
+#endif
+    struct rusage ru;
+    if(wait4(pid, &st, 0, &ru) < 0) {
+        die("wait4 failed: %s", strerror(errno));
+    }
+    r.wall_ns = now_ns() - start;
+    r.ok = WIFEXITED(st) && WEXITSTATUS(st) == 0;
+    return r;
+}
+
+#define SCENARIO_COLD 0
+#define SCENARIO_NOOP 1
+#define SCENARIO_TOUCH 2
+#define SCENARIO_HEADER 3
+
+static const char *scenario_names[] = { "cold", "noop", "touch", "header" };
+
+// puts dir into the state before the scenario
+void prepare(const char *dir, bench_shape_t s, int scenario)
+{
+    char path[PATH_MAX];
+    static int edits;
+    char line[64];
+    snprintf(line, sizeof(line), "// edit %d\n", ++edits);
+    switch(scenario) {
+    case SCENARIO_COLD:
+        clean(dir, s);
+        break;
+    case SCENARIO_TOUCH:
+        // a source of the first library, in a deep graph everything after
+        // it links again
+        snprintf(path, PATH_MAX, "%s/%s/src/s1.c", dir,
+                 s.projects > 1 ? "p0" : "app");
+        append(path, line);
+        break;
+    case SCENARIO_HEADER:
+        snprintf(path, PATH_MAX, "%s/include/h0.h", dir);
+        append(path, line);
+        break;
+    }
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: bench gen <dir> [-n tus] [-p projects] [-s wide|deep] "
+            "[-H headers] [-f fanout]\n"
+            "       bench run [-b bake] [-d workdir] [-n tus,...] [-s "
+            "wide,deep] [-p projects]\n"
+            "                 [-H headers] [-f fanout] [-j jobs] [-l label] "
+            "[-q]\n");
+    exit(2);
+}
+
+int parse_shape(const char *name)
+{
+    for(int i = 0; i < 2; i++) {
+        if(strcmp(name, shape_names[i]) == 0) {
+            return i;
+        }
+    }
+    die("unknown shape '%s', use wide or deep", name);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        usage();
+    }
+    bool gen = strcmp(argv[1], "gen") == 0;
+    if(!gen && strcmp(argv[1], "run") != 0) {
+        usage();
+    }
+    const char *gendir = NULL;
+    if(gen) {
+        if(argc < 3) {
+            usage();
+        }
+        gendir = argv[2];
+        argv++;
+        argc--;
+    }
+    bench_shape_t base = { .tus = 1000, .projects = 8, .headers = 64,
+                           .fanout = 8 };
+    char sizes[256] = "1000,10000";
+    char shapes[64] = "wide,deep";
+    const char *bake = "bake";
+    const char *workdir = "bench-work";
+    const char *label = "";
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool count = true;
+    optind = 2;
+    int opt;
+    while((opt = getopt(argc, argv, "n:p:s:H:f:b:d:j:l:q")) != -1) {
+        switch(opt) {
+        case 'n':
+            snprintf(sizes, sizeof(sizes), "%s", optarg);
+            base.tus = atoi(optarg);
+            break;
+        case 'p':
+            base.projects = atoi(optarg);
+            break;
+        case 's':
+            snprintf(shapes, sizeof(shapes), "%s", optarg);
+            break;
+        case 'H':
+            base.headers = atoi(optarg);
+            break;
+        case 'f':
+            base.fanout = atoi(optarg);
+            break;
+        case 'b':
+            bake = optarg;
+            break;
+        case 'd':
+            workdir = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'q':
+            count = false;
+            break;
+        default:
+            usage();
+        }
+    }
+    if(base.projects < 1 || base.headers < 1 || base.fanout < 0 || jobs < 1) {
+        die("projects, headers and jobs must be positive");
+    }
+    if(gen) {
+        // the first of the list, wide unless -s says otherwise
+        base.shape = parse_shape(strtok(shapes, ","));
+        if(base.tus < base.projects) {
+            die("need at least one source per project");
+        }
+        generate(gendir, base);
+        return 0;
+    }
+    char bakepath[PATH_MAX];
+    if(strchr(bake, '/') && !realpath(bake, bakepath)) {
+        die("cannot find %s: %s", bake, strerror(errno));
+    } else if(!strchr(bake, '/')) {
+        snprintf(bakepath, PATH_MAX, "%s", bake);
+    }
+    for(char *sh = strtok(shapes, ","); sh; sh = strtok(NULL, ",")) {
+        int shape = parse_shape(sh);
+        char *rest = NULL;
+        char list[256];
+        snprintf(list, sizeof(list), "%s", sizes);
+        for(char *n = strtok_r(list, ",", &rest); n;
+            n = strtok_r(NULL, ",", &rest)) {
+            bench_shape_t s = base;
+            s.shape = shape;
+            s.tus = atoi(n);
+            if(s.tus < s.projects) {
+                die("need at least one source per project");
+            }
+            char dir[PATH_MAX];
+            snprintf(dir, PATH_MAX, "%s/%s-%d", workdir, sh, s.tus);
+            fprintf(stderr, "generating %s\n", dir);
+            generate(dir, s);
+            for(int sc = SCENARIO_COLD; sc <= SCENARIO_HEADER; sc++) {
+                fprintf(stderr, "%s %d: %s\n", sh, s.tus, scenario_names[sc]);
+                prepare(dir, s, sc);
+                bench_result_t r = run_bake(bakepath, dir, jobs, false);
+                if(count && r.ok) {
+                    // the same scenario again under ptrace
+                    prepare(dir, s, sc);
+                    bench_result_t c = run_bake(bakepath, dir, jobs, true);
+                    r.syscalls = c.syscalls;
+                    r.maxrss = c.maxrss;
+                }
+                printf("{\"label\":\"%s\",\"shape\":\"%s\",\"tus\":%d,"
+                       "\"projects\":%d,\"headers\":%d,\"fanout\":%d,"
+                       "\"jobs\":%d,\"scenario\":\"%s\",\"ok\":%s,"
+                       "\"wall_ms\":%.3f,\"syscalls\":%lld,"
+                       "\"peak_rss_kib\":%lld}\n",
+                       label, sh, s.tus, s.projects, s.headers, s.fanout,
+                       jobs, scenario_names[sc], r.ok ? "true" : "false",
+                       r.wall_ns / 1e6, (long long)r.syscalls,
+                       (long long)r.maxrss);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
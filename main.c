@@ -7,26 +7,64 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <time.h>
 #include <dirent.h>
+#include <getopt.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#endif
 
 #define VERSION "1.2.2_01"
+
+#ifdef __APPLE__
+#define ST_MTIM(st) ((st).st_mtimespec)
+#else
+#define ST_MTIM(st) ((st).st_mtim)
+#endif
+// false when stdout is not a terminal, logs get no escapes
+bool styl_on = true;
+
 void styl_reset()
 {
+    if(!styl_on) {
+        return;
+    }
     printf("\033[0m");
 }
 
 void styl_set_color(int col)
 {
+    if(!styl_on) {
+        return;
+    }
     printf("\033[38;5;%dm", col);
 }
 void styl_set_tcol(int r, int g, int b)
 {
+    if(!styl_on) {
+        return;
+    }
     printf("\033[38;2;%d;%d;%dm", r, g, b);
 }
 
 void styl_set_bold(bool dobold)
 {
+    if(!styl_on) {
+        return;
+    }
     if(dobold) {
         printf("\033[1m");
     } else {
@@ -36,6 +74,9 @@ void styl_set_bold(bool dobold)
 
 void styl_set_underline(bool dounderline)
 {
+    if(!styl_on) {
+        return;
+    }
     if(dounderline) {
         printf("\033[4m");
     } else {
@@ -43,8 +84,11 @@ void styl_set_underline(bool dounderline)
     }
 }
 
-[[noreturn]] void report_error(const char *fmt, ...)
+void progressbreak();
+
+void verror(const char *fmt, va_list args)
 {
+    progressbreak();
     styl_reset();
     styl_set_underline(true);
     styl_set_color(1);
@@ -52,49 +96,397 @@ void styl_set_underline(bool dounderline)
     printf("Error");
     styl_reset();
     printf(": ");
+    (void)vprintf(fmt, args);
+    styl_reset();
+    printf("\n");
+}
+
+// an error bake can go on after, like a failed build in watch mode
+void print_error(const char *fmt, ...)
+{
     va_list args;
     va_start(args, fmt);
-    (void)vprintf(fmt, args);
+    verror(fmt, args);
     va_end(args);
-    styl_reset();
-    printf("\nError occured, exiting program\n");
+}
+
+[[noreturn]] void report_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    verror(fmt, args);
+    va_end(args);
+    printf("Error occured, exiting program\n");
     exit(1);
 }
 
-void chdir_h(const char *path)
+typedef struct {
+    char *path;
+    bool exists;
+    bool hashed;
+    // mtime is in nanoseconds
+    int64_t mtime;
+    int64_t size;
+    uint64_t ino;
+    uint64_t hash;
+    bool isdir;
+    // a build server saw it change, it is stat()'d again when needed
+    bool stale;
+    // the inotify watch of its dir while a build server keeps it
+    int wd;
+} bake_stat_t;
+
+int64_t stat_mtime(const struct stat *st)
 {
-    if(chdir(path) != 0) {
-        perror("error: chdir() failed");
-        exit(1);
+    return (int64_t)ST_MTIM(*st).tv_sec * 1000000000 + ST_MTIM(*st).tv_nsec;
+}
+
+// headers are shared by most files of a project, so every path is only
+// stat()'d once per run. a build server keeps them between builds and only
+// drops what inotify reports as changed
+typedef struct {
+    bake_stat_t *ent;
+    int cap;
+    int n;
+} bake_statcache_t;
+
+static bake_statcache_t statcache;
+
+uint32_t strhash(const char *s)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while(*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
     }
-    return;
+    return h;
 }
 
-bool needs_rebuild(const char *output, const char *input)
+static void stat_fill(bake_stat_t *e)
 {
     struct stat statbuf = {};
-    if(stat(input, &statbuf) < 0) {
-        report_error("stat(%s, /* ... */) failed: %s", input, strerror(errno));
-        exit(1);
+    e->exists = stat(e->path, &statbuf) == 0;
+    e->hashed = false;
+    e->stale = false;
+    e->isdir = S_ISDIR(statbuf.st_mode);
+    e->mtime = stat_mtime(&statbuf);
+    e->size = statbuf.st_size;
+    e->ino = statbuf.st_ino;
+}
+
+// finds the entry of path, *fresh is set if it was just added and has not
+// been stat()'d yet
+static bake_stat_t *stat_entry(const char *path, bool *fresh)
+{
+    if(statcache.n * 2 >= statcache.cap) {
+        bake_statcache_t old = statcache;
+        statcache.cap = old.cap ? old.cap * 2 : 256;
+        statcache.ent = calloc(statcache.cap, sizeof(bake_stat_t));
+        for(int i = 0; i < old.cap; i++) {
+            if(!old.ent[i].path)
+                continue;
+            uint32_t j = strhash(old.ent[i].path) & (statcache.cap - 1);
+            while(statcache.ent[j].path) {
+                j = (j + 1) & (statcache.cap - 1);
+            }
+            statcache.ent[j] = old.ent[i];
+        }
+        free(old.ent);
     }
-    int inp_path_time = statbuf.st_mtime;
-    if(stat(output, &statbuf) < 0) {
-        if(errno == ENOENT) {
-            return true;
-        };
-        report_error("stat(%s, /* ... */) failed: %s", output, strerror(errno));
-        exit(1);
+    uint32_t i = strhash(path) & (statcache.cap - 1);
+    while(statcache.ent[i].path) {
+        if(strcmp(statcache.ent[i].path, path) == 0) {
+            *fresh = false;
+            return &statcache.ent[i];
+        }
+        i = (i + 1) & (statcache.cap - 1);
+    }
+    bake_stat_t *e = &statcache.ent[i];
+    e->path = strdup(path);
+    statcache.n++;
+    *fresh = true;
+    return e;
+}
+
+bake_stat_t *stat_cached(const char *path)
+{
+    bool fresh;
+    bake_stat_t *e = stat_entry(path, &fresh);
+    if(fresh || e->stale) {
+        stat_fill(e);
+    }
+    return e;
+}
+
+// stat()s path again, for files a command of this run may have written
+bake_stat_t *stat_refresh(const char *path)
+{
+    bool fresh;
+    bake_stat_t *e = stat_entry(path, &fresh);
+    stat_fill(e);
+    return e;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+// XXH64, little endian hosts only
+uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+    if(len >= 32) {
+        uint64_t v1 = seed + XXH_P1 + XXH_P2;
+        uint64_t v2 = seed + XXH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_P1;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while(p + 32 <= end);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + XXH_P5;
+    }
+    h += len;
+    while(p + 8 <= end) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+        p += 8;
+    }
+    if(p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    while(p < end) {
+        h ^= (*p) * XXH_P5;
+        h = rotl64(h, 11) * XXH_P1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// hashes the contents of path, returns false if it can not be read
+bool hash_file(const char *path, uint64_t *out)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat statbuf;
+    if(fstat(fd, &statbuf) < 0) {
+        close(fd);
+        return false;
+    }
+    if(statbuf.st_size == 0) {
+        close(fd);
+        *out = xxh64("", 0, 0);
+        return true;
+    }
+    void *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    *out = xxh64(map, statbuf.st_size, 0);
+    munmap(map, statbuf.st_size);
+    return true;
+}
+
+// contents are only hashed the first time they are needed in a run
+uint64_t stat_hash(bake_stat_t *e)
+{
+    if(!e->hashed) {
+        e->hashed = true;
+        if(!hash_file(e->path, &e->hash)) {
+            e->exists = false;
+        }
+    }
+    return e->hash;
+}
+
+void statcache_cleanup()
+{
+    for(int i = 0; i < statcache.cap; i++) {
+        free(statcache.ent[i].path);
+    }
+    free(statcache.ent);
+    memset(&statcache, 0, sizeof(statcache));
+}
+
+void depfile_for(const char *oname, char *out)
+{
+    strlcpy(out, oname, PATH_MAX);
+    out[strlen(out) - 1] = 'd';
+}
+
+void free_deps(char **deps, int n)
+{
+    for(int i = 0; i < n; i++) {
+        free(deps[i]);
+    }
+    free(deps);
+}
+
+// parses a make style depfile as written by `cc -MMD -MF`, returns every
+// prerequisite of the object (the source file first) or NULL if the
+// depfile can not be read
+char **parse_depfile(const char *path, int *n)
+{
+    FILE *f = fopen(path, "r");
+    if(!f) {
+        return NULL;
+    }
+    char **deps = NULL;
+    char tok[PATH_MAX];
+    int toklen = 0;
+    bool intarget = true;
+    *n = 0;
+    for(;;) {
+        int c = fgetc(f);
+        if(c == '\\') {
+            int nc = fgetc(f);
+            if(nc == '\n' || nc == '\r') {
+                // line continuation
+                c = ' ';
+            } else if(nc == ' ' || nc == '#' || nc == '\\') {
+                if(toklen < PATH_MAX - 1)
+                    tok[toklen++] = nc;
+                continue;
+            } else {
+                if(toklen < PATH_MAX - 1)
+                    tok[toklen++] = c;
+                ungetc(nc, f);
+                continue;
+            }
+        } else if(c == '$') {
+            int nc = fgetc(f);
+            if(nc != '$')
+                ungetc(nc, f);
+        } else if(c == ':' && intarget) {
+            int nc = fgetc(f);
+            ungetc(nc, f);
+            if(nc == ' ' || nc == '\t' || nc == '\n' || nc == EOF) {
+                intarget = false;
+                toklen = 0;
+                continue;
+            }
+        }
+        if(c == EOF || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            if(toklen && !intarget) {
+                tok[toklen] = 0;
+                deps = realloc(deps, sizeof(char *) * (*n + 1));
+                deps[(*n)++] = strdup(tok);
+            }
+            toklen = 0;
+            if(c == EOF)
+                break;
+            continue;
+        }
+        if(toklen < PATH_MAX - 1)
+            tok[toklen++] = c;
     }
-    int out_path_time = statbuf.st_mtime;
-    return inp_path_time > out_path_time;
+    fclose(f);
+    if(intarget) {
+        free_deps(deps, *n);
+        return NULL;
+    }
+    if(!deps) {
+        deps = malloc(1);
+    }
+    return deps;
 }
 
+// a list of strings from the bakefile, the strings belong to the plan
+typedef struct {
+    char **v;
+    int n;
+} bake_strv_t;
+
 typedef struct {
     toml_table_t *cfg;
     // the trio
     char *cc;
     char *as;
     char *ld;
+    // rebuild on content changes instead of mtime changes
+    bool hashrebuild;
+    // jobs in [config], 0 if it is not set
+    int jobs;
+    // object cache, cache_dir as it is written (NULL for the default) and
+    // where it is on this machine
+    bool cache;
+    bool cachecompress;
+    char *cachepath;
+    char cachedir[PATH_MAX];
+    int64_t cachesize;
+    // most sources passed to one cc -c, 0 to compile them one by one
+    int batch;
+    // bake-worker addresses, unix:<path> or <host>:<port>
+    bake_strv_t workers;
+    // linker in [config], and the -fuse-ld= linker and its --version it
+    // picked, NULL to leave it to cc
+    char *linkerset;
+    char *linker;
+    char ldversion[256];
+    // threads of the linker, 0 for its default
+    int linkthreads;
+    // -gsplit-dwarf compiles, --gdb-index links
+    bool splitdwarf;
+    bool gdbindex;
+    // asked once, clang and gcc name precompiled headers differently
+    bool ccknown;
+    bool ccclang;
 } bake_config_t;
 
 typedef struct {
@@ -102,31 +494,497 @@ typedef struct {
     bool islib;
     char *srcs;
     char *bindir;
-    toml_array_t *ccflags;
-    toml_array_t *incflags;
-    toml_array_t *ldflags;
-    toml_array_t *deps;
+    bake_strv_t ccflags;
+    bake_strv_t incflags;
+    bake_strv_t ldflags;
+    // node indices of the deps, externals follow the projects
+    int *deps;
+    int ndeps;
     char *binname;
     char *scrname;
     char *idname;
-    bool depcompiled;
-    bool cleaned;
+    bool thin;
+    // compile the sources in batches of about unitybatch files, except the
+    // ones named in unityexclude
+    bool unity;
+    int unitybatch;
+    bake_strv_t unityexclude;
+    // header that is precompiled and included into every source, or NULL
+    char *pch;
+    int lto;
+    // parallel codegen jobs of an lto link, 0 for the linker's default
+    int ltojobs;
+    // the thinlto cache of the link, in MiB and hours
+    int64_t ltocachesize;
+    int ltocacheexpire;
+    // the training command of bake pgo, NULL if the project has none
+    char *pgotrain;
+    // bake pgo builds the instrumented variant, bindir is <bin>/pgo
+    bool pgogen;
 } bake_project_t;
 
+#define LTO_OFF 0
+#define LTO_FULL 1
+// clang only, gcc gets full lto
+#define LTO_THIN 2
+
+// where a project is in the build
+#define PROJ_COMPILING 0
+#define PROJ_LINKING 1
+#define PROJ_DONE 2
+#define PROJ_FAILED 3
+// one of its deps failed, it is not linked
+#define PROJ_SKIPPED 4
+
+// where the precompiled header of a project is in the build
+#define PCH_UNKNOWN 0
+#define PCH_BUILDING 1
+#define PCH_READY 2
+// it did not build, the project compiles without it
+#define PCH_BROKEN 3
+
+// a project in the dependency graph, same index as in b.proj. externals
+// follow the projects, b.ext[i] is node b.projs + i
 typedef struct {
-    toml_array_t *buildcmd;
+    const char *name;
+    int state;
+    int *deps;
+    int ndeps;
+    int *rdeps;
+    int nrdeps;
+    // compiles still queued or running
+    int compiling;
+    // deps that are not linked yet
+    int waiting;
+    // externals in deps that are not built yet, compiling waits for them
+    int extwaiting;
+    // for an external, the projects that named it in deps
+    int *starts;
+    int nstarts;
+    char **names;
+    int bn;
+    int pch;
+    // spans of the trace, -1 if there is none: what the compiles waited
+    // for, the compile that ended last and the link or external build
+    int tracegate;
+    int tracecompile;
+    int tracedone;
+    // how long the build takes at least once its compiles are done: its
+    // own link and the longest chain of links waiting on it, in
+    // nanoseconds as the build database has them
+    int64_t tail;
+} bake_node_t;
+
+// what tells bake that an external is still built
+#define EXT_FP_NONE 0
+// every file under loc
+#define EXT_FP_TREE 1
+// the files in outputs
+#define EXT_FP_OUTPUTS 2
+
+typedef struct {
+    bake_strv_t buildcmd;
     char *loc;
     char *chdir;
     char *scrname;
     char *idname;
+    int fingerprint;
+    bake_strv_t outputs;
+    // built once in this run, watch mode does not run it again unless the
+    // fingerprint says so
+    bool built;
 } bake_ext_t;
 
+// a plain command
+#define JOB_RUN 0
+// with the object cache a compile is preprocessed first, then the object
+// is either unpacked from the cache or compiled
+#define JOB_CPP 1
+#define JOB_UNPACK 2
+#define JOB_CC 3
+// compresses a new object into the cache
+#define JOB_PACK 4
+// links or archives a project, may run a second command after the first
+#define JOB_LINK 5
+// the buildcmd of an external
+#define JOB_EXT 6
+// bake-worker send, compiles the preprocessed source on a worker
+#define JOB_REMOTE 7
+
+// a compile command ends with <depfile> -o <object> -c <source>
+#define COMPILE_SUFFIX 5
+
+// several sources of a project compiled by one cc -c. it runs in a scratch
+// dir in bin, cc puts the objects into its working dir
+typedef struct {
+    int n;
+    char **srcs;
+    char **outs;
+    uint64_t *sigs;
+} bake_batch_t;
+
+typedef struct bake_argblock {
+    struct bake_argblock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} bake_argblock_t;
+
+typedef struct {
+    int argc;
+    int cap;
+    // NULL terminated
+    char **argv;
+    bake_argblock_t *blocks;
+} bake_args_t;
+
+// what a job wrote to stdout or stderr, it is printed in one piece once the
+// job is done
+typedef struct {
+    // read end of the pipe, -1 once it is closed
+    int fd;
+    char *buf;
+    size_t len;
+    size_t cap;
+} bake_capture_t;
+
+typedef struct {
+    pid_t pid;
+    int stage;
+    bake_args_t args;
+    char *name;
+    // project the job belongs to
+    int proj;
+    // file the job produces, NULL for cache jobs
+    char *out;
+    uint64_t sig;
+    int64_t start;
+    // the command of the next stage while an earlier stage runs
+    bake_args_t next;
+    uint64_t key[2];
+    // what a link reads, recorded once it succeeded
+    int nins;
+    char **ins;
+    // dir the command runs in, NULL for the bakefile dir
+    char *cwd;
+    bake_capture_t capture[2];
+    // errno of a command that could not be started
+    int spawnerr;
+    // cpu time in nanoseconds and peak memory in KiB over all stages
+    int64_t cpu;
+    int64_t maxrss;
+    // builds the precompiled header of proj
+    bool pch;
+    bake_batch_t *batch;
+    // span of the previous stage + 1, 0 in the first stage
+    int traceprev;
+    // worker + 1 the compile holds a slot of, 0 if it compiles here
+    int worker;
+    // how long the build takes at least once the job starts, the queue
+    // starts the highest first
+    int64_t prio;
+} bake_job_t;
+
+typedef struct {
+    bake_job_t *slots;
+    int width;
+    int running;
+    int done;
+    int total;
+    int failed;
+    // compiles that did not get a slot yet, a heap on prio
+    bake_job_t *queue;
+    int queued;
+    int queuecap;
+    // compile time and source size of the objects planned so far that
+    // have a duration in the build database, new sources are estimated
+    // at the same rate
+    int64_t estns;
+    int64_t estbytes;
+    // room for the pipes of every slot and the fds watch and server mode
+    // wait on
+    struct pollfd *pollfds;
+} bake_pool_t;
+
+// on disk layout of the build database (.bake.db next to the bakefile):
+// a header, a power of two sized table of slots and the records, every
+// part is 8 byte aligned and the file is only ever replaced as a whole
+#define BAKEDB_MAGIC "BAKEDB\0\0"
+#define BAKEDB_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nslots;
+    uint64_t size;
+    uint64_t nrecs;
+} bake_dbhdr_t;
+
+typedef struct {
+    // hash of the key, 0 marks an empty slot
+    uint64_t hash;
+    uint64_t off;
+} bake_dbslot_t;
+
+typedef struct {
+    int64_t mtime;
+    int64_t size;
+    uint64_t ino;
+    uint64_t hash;
+    // offset of the path from the start of the record
+    uint32_t path;
+    uint32_t pad;
+} bake_dbinput_t;
+
+// the content hashes of the inputs are valid
+#define DBREC_HASHED 1
+// the record is a cached directory listing, inputs[0] is the directory
+// itself and the others are the names of its sources
+#define DBREC_DIR 2
+// the record is the fingerprint of an external, its key is not a file
+#define DBREC_EXT 4
+
+// records look the same on disk and in memory, so records written during
+// a run are plain malloc()'d blobs that are copied into the new file
+typedef struct {
+    uint32_t len;
+    uint32_t ninputs;
+    // offset of the key (the output path) from the start of the record
+    uint32_t key;
+    uint32_t flags;
+    uint64_t sig;
+    // how long the step took last time, in nanoseconds
+    int64_t duration;
+    // the cpu time its commands used, in nanoseconds, and their peak
+    // memory in KiB
+    int64_t cpu;
+    int64_t maxrss;
+    int64_t out_mtime;
+    int64_t out_size;
+    uint64_t out_ino;
+    bake_dbinput_t inputs[];
+} bake_dbrec_t;
+
+typedef struct {
+    char path[PATH_MAX];
+    uint8_t *map;
+    size_t mapsize;
+    bake_dbslot_t *slots;
+    uint32_t nslots;
+    // records replaced during this run, open addressed by key
+    bake_dbrec_t **pending;
+    uint32_t cappending;
+    uint32_t npending;
+} bake_db_t;
+
+typedef struct {
+    uint64_t identity;
+    int hits;
+    int misses;
+    // bytes stored in this run
+    int64_t added;
+} bake_cache_t;
+
+// a dir watched in watch mode, b.watch.dirs is indexed by the watch
+// descriptor
+typedef struct {
+    char *path;
+    // any source in it counts, not only the files that are in the set
+    bool srcs;
+} bake_watchdir_t;
+
+typedef struct {
+    char **ent;
+    int cap;
+    int n;
+} bake_strset_t;
+
+typedef struct {
+    bool on;
+    int fd;
+    bake_watchdir_t *dirs;
+    int ndirs;
+    // "<wd>/<name>" of every file a build read
+    bake_strset_t files;
+    // "<wd>/<name>" of what bake writes itself, the database, the plan,
+    // the history and the trace
+    bake_strset_t own;
+    // "<wd>/<name>" of every event since the stat cache was synced last,
+    // "<wd>/" for a dir that is gone. overflow if events were lost
+    bake_strset_t pending;
+    bool overflow;
+    char bakefile[PATH_MAX];
+    // the last build failed, it may have been missing a file
+    bool failed;
+    // a file that was read changed since the build started
+    bool changed;
+    char first[PATH_MAX];
+    bool bakefilechanged;
+    bool quit;
+} bake_watch_t;
+
+typedef struct {
+    bool on;
+    // the listening socket and the connection of the running build
+    int fd;
+    int conn;
+    int devnull;
+    // -j and -k the server was started with, a client can override them
+    int jobs;
+    bool keepgoing;
+    // the bakefile as it was parsed, the server restarts once it changes
+    struct stat bakefile;
+    // what parsing the changed bakefile printed if it failed, the server
+    // keeps the old one and shows it to every client until it is fixed
+    char *broken;
+    // the socket is only removed by the server, not by its children
+    pid_t pid;
+    // the client hung up, the running build is cancelled
+    bool cancel;
+    bool quit;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} bake_server_t;
+
+#define SERVER_MAGIC 0x454b4142
+#define SERVER_BUILD 0
+#define SERVER_STOP 1
+// the server answers a request with SERVER_ACCEPTED and the exit status of
+// the build, or with SERVER_REFUSED if it serves another bakefile
+#define SERVER_ACCEPTED -1
+#define SERVER_REFUSED -2
+
+// a span of --trace, times in nanoseconds
+typedef struct {
+    char *name;
+    const char *cat;
+    int64_t start;
+    int64_t end;
+    // pool slot + 1, 0 is bake itself
+    int tid;
+    // the span this one waited for, -1 if none. following it from the span
+    // that ended last gives the critical path
+    int prev;
+    int64_t cpu;
+    int64_t maxrss;
+} bake_span_t;
+
+typedef struct {
+    bool on;
+    char path[PATH_MAX];
+    bake_span_t *spans;
+    int n;
+    int cap;
+    int64_t origin;
+    int64_t buildstart;
+    // last span of every pool slot, a queued job waited for it
+    int *slotlast;
+    int nslots;
+} bake_trace_t;
+
+// the history file (.bake.history next to the bakefile) is appended one
+// build at a time: a run line and a line for every compile and link that
+// ran. it is cut in half once it gets bigger than this
+#define HISTORY_MAX (16 << 20)
+
+typedef struct {
+    // the lines of the build that is running
+    char *buf;
+    size_t len;
+    size_t cap;
+} bake_history_t;
+
+// bake-worker send exits with this when the worker could not take the
+// job, it is compiled here then
+#define REMOTE_UNAVAILABLE 75
+#define REMOTE_TIMEOUT_MS 2000
+
+typedef struct {
+    char *addr;
+    int slots;
+    int busy;
+    // did not answer or compiles with another compiler, not used until the
+    // next build
+    bool down;
+} bake_worker_t;
+
+typedef struct {
+    bake_worker_t *workers;
+    int n;
+    // over the workers that are up, the pool is that much wider than -j
+    int slots;
+    int busy;
+    char identity[512];
+    // bake-worker, runs every remote compile
+    char relay[PATH_MAX];
+    int compiled;
+    int fallbacks;
+} bake_remote_t;
+
+// the progress of a build. on a terminal it is a frame that is redrawn in
+// place a few times a second, otherwise every compile gets a plain line
+#define RENDER_NS 100000000
+#define RENDER_BAR 25
+#define RENDER_JOBS 8
+typedef struct {
+    bool tty;
+    // a build is running
+    bool on;
+    // lines of the frame on screen, 0 while there is none
+    int lines;
+    // a compile finished since the last frame
+    bool dirty;
+    int64_t last;
+    // the next frame, written at once
+    char *buf;
+    size_t len;
+    size_t cap;
+} bake_render_t;
+
+typedef struct {
+    // the strings of the bakefile while it is parsed
+    bake_argblock_t *blocks;
+    // the plan in use, mapped or written in this run
+    uint8_t *map;
+    size_t mapsize;
+    bool mapped;
+    // plan_io() reads the plan instead of writing it
+    bool load;
+    bool bad;
+    uint32_t *words;
+    uint32_t nwords;
+    uint32_t capwords;
+    uint32_t pos;
+    char *strs;
+    uint32_t nstrs;
+    uint32_t capstrs;
+    // offsets + 1 of the strings written so far, open addressed by hash
+    uint32_t *set;
+    uint32_t capset;
+    uint32_t nset;
+} bake_plan_t;
+
+// sent by a client together with its stdout and stderr
+typedef struct {
+    uint32_t magic;
+    int32_t op;
+    // 0 if the client was not given -j
+    int32_t jobs;
+    int32_t keepgoing;
+    char version[32];
+    char cwd[PATH_MAX];
+    char bakefile[PATH_MAX];
+} bake_request_t;
+
 typedef struct {
     char bakefile[PATH_MAX];
     toml_table_t *toml;
     char err[512];
     bake_config_t cfg;
     bake_project_t *proj;
+    bake_node_t *node;
+    int nodes;
+    // projects with every dep before its dependents
+    int *order;
     bake_ext_t *ext;
     toml_table_t *projlist;
     toml_table_t *extlist;
@@ -134,15 +992,27 @@ typedef struct {
     int projs;
     int exts;
     char cwd[PATH_MAX];
+    int jobs;
+    bool keepgoing;
+    bake_pool_t pool;
+    bake_db_t db;
+    bake_cache_t cache;
+    bake_watch_t watch;
+    bake_server_t server;
+    bake_trace_t trace;
+    bake_history_t history;
+    bake_remote_t remote;
+    bake_render_t render;
+    bake_plan_t plan;
+    // SIGINT and SIGTERM are read from sigfd in watch and server mode, so
+    // one poll() sees the output of jobs, changes and ^C
+    int sigfd;
+    sigset_t oldmask;
+    char **argv;
 } bake_state_t;
 
 bake_state_t b;
 
-void resetcwd()
-{
-    chdir_h(b.cwd);
-}
-
 void handlerr()
 {
     if(!b.toml) {
@@ -165,19 +1035,17 @@ void handlerr()
 
 void cleanup_ext(bake_ext_t e)
 {
-    free(e.loc);
-    free(e.idname);
-    free(e.scrname);
-    free(e.chdir);
+    free(e.buildcmd.v);
+    free(e.outputs.v);
 }
 
 void cleanup_proj(bake_project_t p)
 {
-    free(p.srcs);
-    free(p.bindir);
-    free(p.binname);
-    free(p.scrname);
-    free(p.idname);
+    free(p.ccflags.v);
+    free(p.incflags.v);
+    free(p.ldflags.v);
+    free(p.unityexclude.v);
+    free(p.deps);
 }
 
 void cleanup_projs()
@@ -212,13 +1080,13 @@ void add_extproj(bake_ext_t ext)
     return;
 }
 
+void plan_close();
+
 void cleanup()
 {
-    cleanup_projs();
-    free(b.cfg.cc);
-    free(b.cfg.as);
-    free(b.cfg.ld);
-    toml_free(b.toml);
+    plan_close();
+    statcache_cleanup();
+    free(b.cfg.linker);
 }
 
 void tab()
@@ -226,412 +1094,4972 @@ void tab()
     printf("    ");
 }
 
+bool is_source(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if((!ext) || (ext == name))
+        return false;
+    return strcmp(ext, ".c") == 0;
+}
+
 static int parse_ext(const struct dirent *dir)
 {
     if(!dir)
         return 0;
 
     if(dir->d_type == DT_REG) {
-        const char *ext = strrchr(dir->d_name, '.');
-        if((!ext) || (ext == dir->d_name))
-            return 0;
-        else {
-            if(strcmp(ext, ".c") == 0)
-                return 1;
-        }
+        return is_source(dir->d_name);
     }
 
     return 0;
 }
 
-void progressbarprint(int prog)
-{
-    // GREEN
-    // #b9f27c
-    // BLUE
-    // #7da6ff
-    float r0 = (float)(0xb9) / (float)0xff;
-    float r1 = (float)(0x7d) / (float)0xff;
-    float g0 = (float)(0xf2) / (float)0xff;
-    float g1 = (float)(0xa6) / (float)0xff;
-    float b0 = (float)(0x7c) / (float)0xff;
-    float b1 = (float)(0xff) / (float)0xff;
-
-    const int n = 25;
-    int c = prog / (100 / n);
-    for(int i = 0; i < c; i++) {
-        float t = (float)i / (float)n;
-        float R = ((1.0 - t) * r0) + (t * r1);
-        float G = ((1.0 - t) * g0) + (t * g1);
-        float B = ((1.0 - t) * b0) + (t * b1);
-        int ir = (int)(R * 255);
-        int ig = (int)(G * 255);
-        int ib = (int)(B * 255);
-        styl_set_tcol(ir, ig, ib);
-        styl_set_bold(true);
-        printf("=");
-        styl_reset();
-    }
-    if(c != n) {
-        float t = (float)c / (float)n;
-        float R = ((1.0 - t) * r0) + (t * r1);
-        float G = ((1.0 - t) * g0) + (t * g1);
-        float B = ((1.0 - t) * b0) + (t * b1);
-        int ir = (int)(R * 255);
-        int ig = (int)(G * 255);
-        int ib = (int)(B * 255);
-        styl_set_tcol(ir, ig, ib);
-        styl_set_bold(true);
-        printf(">");
-        styl_reset();
-    }
-    c += (c != n);
-    c = n - c;
-    for(int i = 0; i < c; i++) {
-        printf(" ");
-    }
-}
-
-void _add_argv(int argcnt, char ***argv, char *toadd)
-{
-    *argv = realloc(*argv, sizeof(char *) * (argcnt + 1));
-    char **local = *argv;
-    local[argcnt] = strdup(toadd);
-}
-#define add_argv(argcnt, argv, toadd)   \
-    {                                   \
-        _add_argv(argcnt, argv, toadd); \
-        argcnt++;                       \
-    }
-
-void exec(int argc, char *argv[])
-{
-    int stat, exitcode;
-    int forked_pid = fork();
-    if(forked_pid == 0) {
-        execvp(argv[0], argv);
-        exit(EXIT_SUCCESS);
-    } else {
-        waitpid(forked_pid, &stat, 0);
-        if(WIFSIGNALED(stat)) {
-            report_error(
-                "program expierenced error that is not related to the compilation of project");
-        }
-        exitcode = WEXITSTATUS(stat);
-        if(exitcode) {
-            report_error("program errored, terminating bake");
-        }
-    }
-    return;
+int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-void linkapp(bake_project_t p, struct dirent **list, int bn)
+// records a span that ends now, returns its index or -1 without --trace
+int trace_span(const char *cat, const char *name, int64_t start, int tid,
+               int prev)
 {
-    tab();
-    styl_set_bold(true);
-    styl_set_color(5);
-    printf("Linking ");
-    styl_reset();
-    printf("%s\n", p.scrname);
-    int argc = 0;
-    char **argv = malloc(1);
-    add_argv(argc, &argv, b.cfg.ld);
-    int ccflag_cnt, incflag_cnt, ldflag_cnt;
-    ccflag_cnt = toml_array_nelem(p.ccflags);
-    incflag_cnt = toml_array_nelem(p.incflags);
-    ldflag_cnt = toml_array_nelem(p.ldflags);
-
-    for(int i = 0; i < incflag_cnt; i++) {
-        add_argv(argc, &argv, toml_string_at(p.incflags, i).u.s);
-    }
-    for(int i = 0; i < ccflag_cnt; i++) {
-        add_argv(argc, &argv, toml_string_at(p.ccflags, i).u.s);
+    if(!b.trace.on) {
+        return -1;
     }
-    if(ldflag_cnt != 1 && strcmp(toml_string_at(p.ldflags, 0).u.s, "") != 0) {
-        for(int i = 0; i < ldflag_cnt; i++) {
-            add_argv(argc, &argv, toml_string_at(p.ldflags, i).u.s);
-        }
+    if(b.trace.n == b.trace.cap) {
+        b.trace.cap = b.trace.cap ? b.trace.cap * 2 : 256;
+        b.trace.spans =
+            realloc(b.trace.spans, sizeof(bake_span_t) * b.trace.cap);
     }
-    char *nm = malloc(PATH_MAX);
-    for(int i = 0; i < bn; i++) {
-        char *freeme = strdup(list[i]->d_name);
-        memset(nm, 0, PATH_MAX);
-        strlcpy(nm, p.srcs, PATH_MAX);
-        strlcat(nm, "/", PATH_MAX);
-        strlcat(nm, freeme, PATH_MAX);
-        char *og = freeme;
-        freeme = strdup(nm);
-        freeme[strlen(freeme) - 1] = 'o';
-        add_argv(argc, &argv, freeme);
-        free(freeme);
-        free(og);
-    }
-    free(nm);
-    char *freeme = strdup("-o");
-    char *freeme1 = malloc(PATH_MAX);
-    strlcpy(freeme1, p.bindir, PATH_MAX);
-    strlcat(freeme1, "/", PATH_MAX);
-    strlcat(freeme1, p.binname, PATH_MAX);
-    add_argv(argc, &argv, freeme);
-    add_argv(argc, &argv, freeme1);
-    free(freeme);
-    free(freeme1);
-    exec(argc, argv);
-}
-
-void linklib(bake_project_t p, struct dirent **list, int bn)
+    b.trace.spans[b.trace.n] = (bake_span_t){ .name = strdup(name),
+                                              .cat = cat,
+                                              .start = start,
+                                              .end = now_ns(),
+                                              .tid = tid,
+                                              .prev = prev };
+    return b.trace.n++;
+}
+
+// the span of the two that ended later
+int trace_later(int a, int c)
 {
-    tab();
-    styl_set_bold(true);
-    styl_set_color(5);
-    printf("Linking ");
-    styl_reset();
-    printf("%s\n", p.scrname);
-    int argc = 0;
-    char **argv = malloc(1);
-    char *arcmd = strdup("ar");
-    add_argv(argc, &argv, arcmd);
-
-    char *freeme = strdup("rcs");
-    char *freeme1 = malloc(PATH_MAX);
-    strlcpy(freeme1, p.bindir, PATH_MAX);
-    strlcat(freeme1, "/", PATH_MAX);
-    strlcat(freeme1, p.binname, PATH_MAX);
-    add_argv(argc, &argv, freeme);
-    add_argv(argc, &argv, freeme1);
-    free(freeme);
-    free(freeme1);
-    char *nm = malloc(PATH_MAX);
-    for(int i = 0; i < bn; i++) {
-        char *freeme = strdup(list[i]->d_name);
-        memset(nm, 0, PATH_MAX);
-        strlcpy(nm, p.srcs, PATH_MAX);
-        strlcat(nm, "/", PATH_MAX);
-        strlcat(nm, freeme, PATH_MAX);
-        char *og = freeme;
-        freeme = strdup(nm);
-        freeme[strlen(freeme) - 1] = 'o';
-        add_argv(argc, &argv, freeme);
-        free(freeme);
-        free(og);
+    if(a < 0 || (c >= 0 && b.trace.spans[c].end > b.trace.spans[a].end)) {
+        return c;
     }
-    free(nm);
-
-    exec(argc, argv);
-    free(arcmd);
+    return a;
 }
 
-void compile(bake_project_t p, char *name, char *oname, int i, int n)
+void trace_json_str(FILE *f, const char *s)
 {
-    printf("\r");
-    tab();
-    styl_set_bold(true);
-    styl_set_color(4);
-    printf("Compiling ");
-    styl_reset();
-    //printf("%s\n", name);
-    styl_set_color(2);
-    printf("[");
-    styl_reset();
-    float p_ = (float)i / (float)n;
-    p_ *= 100;
-    progressbarprint((int)p_);
-    styl_set_color(4);
-    printf("]");
-    styl_reset();
-    styl_set_bold(true);
-    printf(" %d/%d", i, n);
-    styl_set_bold(false);
-    printf(" %s                   ", name);
-
-    int argc = 0;
-    char **argv = malloc(1);
-    add_argv(argc, &argv, b.cfg.cc);
-    int ccflag_cnt, incflag_cnt;
-    ccflag_cnt = toml_array_nelem(p.ccflags);
-    incflag_cnt = toml_array_nelem(p.incflags);
-    for(int i = 0; i < ccflag_cnt; i++) {
-        add_argv(argc, &argv, toml_string_at(p.ccflags, i).u.s);
-    }
-    for(int i = 0; i < incflag_cnt; i++) {
-        add_argv(argc, &argv, toml_string_at(p.incflags, i).u.s);
-    }
-    char *nm = malloc(PATH_MAX);
-    strlcpy(nm, ".", PATH_MAX);
-    strlcat(nm, "/", PATH_MAX);
-    strlcat(nm, name, PATH_MAX);
-    char *freeme1 = strdup("-o");
-    char *freeme2 = strdup("-c");
-    char *freeme3 = malloc(PATH_MAX);
-    strlcpy(freeme3, ".", PATH_MAX);
-    strlcat(freeme3, "/", PATH_MAX);
-    strlcat(freeme3, oname, PATH_MAX);
-    add_argv(argc, &argv, freeme1);
-    add_argv(argc, &argv, freeme3);
-    add_argv(argc, &argv, freeme2);
-    add_argv(argc, &argv, nm);
-    free(freeme1);
-    free(freeme2);
-    free(freeme3);
-    /*printf("Arguments: %d\n", argc);
-    printf("Argument list:\n");
-    for(int i = 0; i < argc; i++) {
-        printf("\t[%d] %s\n", i, argv[i]);
-    }*/
-    exec(argc, argv);
-    free(nm);
-    for(int i = 0; i < argc; i++) {
-        free(argv[i]);
+    fputc('"', f);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') {
+            fputc('\\', f);
+            fputc(*s, f);
+        } else if((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", *s);
+        } else {
+            fputc(*s, f);
+        }
     }
+    fputc('"', f);
 }
 
-void compilecleanup(bake_project_t p)
+void status(int color, const char *verb, const char *name);
+
+// writes the spans as chrome trace events (chrome://tracing, perfetto)
+// and prints the critical path of the build
+void trace_finish()
 {
-    int ccflag_cnt, incflag_cnt, ldflag_cnt, depcnt;
-    ccflag_cnt = toml_array_nelem(p.ccflags);
-    incflag_cnt = toml_array_nelem(p.incflags);
-    ldflag_cnt = toml_array_nelem(p.ldflags);
-    depcnt = toml_array_nelem(p.deps);
-    for(int i = 0; i < ccflag_cnt; i++) {
-        free(toml_string_at(p.ccflags, i).u.s);
+    if(!b.trace.on) {
+        return;
     }
-    for(int i = 0; i < incflag_cnt; i++) {
-        free(toml_string_at(p.incflags, i).u.s);
+    FILE *f = fopen(b.trace.path, "w");
+    if(!f) {
+        print_error("cannot write %s: %s", b.trace.path, strerror(errno));
+    } else {
+        fprintf(f, "{\"traceEvents\":[\n");
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":0,\"args\":{\"name\":\"bake\"}}");
+        for(int i = 1; i <= b.pool.width; i++) {
+            fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                       "\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"slot %d\"}}",
+                    i, i);
+        }
+        for(int i = 0; i < b.trace.n; i++) {
+            bake_span_t *s = &b.trace.spans[i];
+            fprintf(f, ",\n{\"name\":");
+            trace_json_str(f, s->name);
+            fprintf(f,
+                    ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":1,\"tid\":%d",
+                    s->cat, (s->start - b.trace.origin) / 1e3,
+                    (s->end - s->start) / 1e3, s->tid);
+            if(s->tid) {
+                fprintf(f, ",\"args\":{\"cpu_ms\":%.3f,\"maxrss_kib\":%lld}",
+                        s->cpu / 1e6, (long long)s->maxrss);
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "\n]}\n");
+        fclose(f);
     }
-    for(int i = 0; i < ldflag_cnt; i++) {
-        free(toml_string_at(p.ldflags, i).u.s);
+    int last = -1;
+    for(int i = 0; i < b.trace.n; i++) {
+        if(b.trace.spans[i].tid) {
+            last = trace_later(last, i);
+        }
+    }
+    if(last >= 0) {
+        int64_t wall = now_ns() - b.trace.buildstart;
+        int64_t path = 0;
+        int n = 0;
+        for(int i = last; i >= 0; i = b.trace.spans[i].prev) {
+            path += b.trace.spans[i].end - b.trace.spans[i].start;
+            n++;
+        }
+        char sum[64];
+        snprintf(sum, sizeof(sum), "%.2fs of %.2fs wall time", path / 1e9,
+                 wall / 1e9);
+        status(3, "Critical path", sum);
+        // from the end of the build back, the first ones matter most
+        for(int i = last, k = 0; i >= 0 && k < 20; i = b.trace.spans[i].prev) {
+            bake_span_t *s = &b.trace.spans[i];
+            tab();
+            tab();
+            printf("%7.3fs %-7s %s\n", (s->end - s->start) / 1e9, s->cat,
+                   s->name);
+            k++;
+        }
+        if(n > 20) {
+            tab();
+            tab();
+            printf("... %d more\n", n - 20);
+        }
+    }
+    for(int i = 0; i < b.trace.n; i++) {
+        free(b.trace.spans[i].name);
     }
-    for(int i = 0; i < depcnt; i++) {
-        free(toml_string_at(p.deps, i).u.s);
+    b.trace.n = 0;
+    for(int i = 0; i < b.trace.nslots; i++) {
+        b.trace.slotlast[i] = -1;
     }
 }
 
-void extcleanup(bake_ext_t e)
+uint64_t db_keyhash(const char *key)
 {
-    int bc_cnt = toml_array_nelem(e.buildcmd);
-    for(int i = 0; i < bc_cnt; i++) {
-        free(toml_string_at(e.buildcmd, i).u.s);
-    }
+    uint64_t h = xxh64(key, strlen(key), 0);
+    return h ? h : 1;
 }
 
-void build_project(bake_project_t p)
+static inline const char *dbrec_key(const bake_dbrec_t *r)
 {
-    if(p.depcompiled) {
-        if(!p.cleaned) {
-            p.cleaned = true;
-            compilecleanup(p);
-        }
-        return;
+    return (const char *)r + r->key;
+}
+
+static inline const char *dbinput_path(const bake_dbrec_t *r, uint32_t i)
+{
+    return (const char *)r + r->inputs[i].path;
+}
+
+// the path of name in the dir of the bakefile
+void bakefile_sibling(const char *name, char *out, size_t len)
+{
+    char dir[PATH_MAX];
+    strlcpy(dir, b.bakefile, PATH_MAX);
+    char *slash = strrchr(dir, '/');
+    if(slash) {
+        *slash = 0;
     } else {
-        int depcount = toml_array_nelem(p.deps);
-        if(depcount) {
-            for(int i = 0; i < depcount; i++) {
-                toml_datum_t depnam = toml_string_at(p.deps, i);
-
-                // search for the dependice
-                int dep_indx = -1;
-                for(int i = 0; i < b.projs; i++) {
-                    if(strcmp(b.proj[i].idname, depnam.u.s) == 0) {
-                        dep_indx = i;
-                    }
-                }
-                if(dep_indx == -1) {
-                    report_error("dependency '%s' not found", depnam.u.s);
-                }
-                styl_reset();
-                styl_set_bold(true);
-                styl_set_color(3);
-                tab();
-                printf("Fetching");
-                styl_reset();
-                printf(" %s\n", b.proj[dep_indx].scrname);
-                //printf("dbg: compiling dep '%s'\n", depnam.u.s);
-                build_project(b.proj[dep_indx]);
-                b.proj[dep_indx].depcompiled = true;
-            }
-        } else
-            p.depcompiled = true;
+        strlcpy(dir, ".", PATH_MAX);
     }
-    struct dirent **list;
-    int n, bn, i;
-    i = 0;
-    n = scandir(p.srcs, &list, parse_ext, alphasort);
-    bn = n;
-    if(n < 0) {
-        perror("scandir");
+    snprintf(out, len, "%s/%s", dir, name);
+}
+
+void db_open()
+{
+    bakefile_sibling(".bake.db", b.db.path, PATH_MAX);
+    int fd = open(b.db.path, O_RDONLY);
+    if(fd < 0) {
+        return;
+    }
+    struct stat statbuf;
+    if(fstat(fd, &statbuf) < 0 ||
+       (size_t)statbuf.st_size < sizeof(bake_dbhdr_t)) {
+        close(fd);
+        return;
+    }
+    uint8_t *map =
+        mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return;
+    }
+    bake_dbhdr_t *hdr = (bake_dbhdr_t *)map;
+    if(memcmp(hdr->magic, BAKEDB_MAGIC, 8) != 0 ||
+       hdr->version != BAKEDB_VERSION ||
+       hdr->size != (uint64_t)statbuf.st_size || !hdr->nslots ||
+       (hdr->nslots & (hdr->nslots - 1)) ||
+       sizeof(bake_dbhdr_t) + hdr->nslots * sizeof(bake_dbslot_t) >
+           hdr->size) {
+        // another version or not a database at all, start over
+        munmap(map, statbuf.st_size);
+        return;
+    }
+    b.db.map = map;
+    b.db.mapsize = statbuf.st_size;
+    b.db.slots = (bake_dbslot_t *)(map + sizeof(bake_dbhdr_t));
+    b.db.nslots = hdr->nslots;
+}
+
+static bake_dbrec_t *db_mapped_at(uint32_t slot)
+{
+    bake_dbslot_t *s = &b.db.slots[slot];
+    if(s->off + sizeof(bake_dbrec_t) > b.db.mapsize) {
+        return NULL;
+    }
+    bake_dbrec_t *r = (bake_dbrec_t *)(b.db.map + s->off);
+    if(r->len < sizeof(bake_dbrec_t) || s->off + r->len > b.db.mapsize ||
+       r->key >= r->len ||
+       sizeof(bake_dbrec_t) + (uint64_t)r->ninputs * sizeof(bake_dbinput_t) >
+           r->len ||
+       ((char *)r)[r->len - 1] != 0) {
+        return NULL;
+    }
+    // every string has to end inside of the record
+    for(uint32_t i = 0; i < r->ninputs; i++) {
+        if(r->inputs[i].path >= r->len) {
+            return NULL;
+        }
+    }
+    return r;
+}
+
+static bake_dbrec_t *db_mapped(const char *key, uint64_t h)
+{
+    if(!b.db.map) {
+        return NULL;
+    }
+    uint32_t mask = b.db.nslots - 1;
+    uint32_t i = h & mask;
+    for(uint32_t probes = 0; probes < b.db.nslots; probes++) {
+        if(!b.db.slots[i].hash) {
+            return NULL;
+        }
+        if(b.db.slots[i].hash == h) {
+            bake_dbrec_t *r = db_mapped_at(i);
+            if(r && strcmp(dbrec_key(r), key) == 0) {
+                return r;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+static bake_dbrec_t **db_pending_slot(const char *key, uint64_t h)
+{
+    uint32_t mask = b.db.cappending - 1;
+    uint32_t i = h & mask;
+    while(b.db.pending[i] && strcmp(dbrec_key(b.db.pending[i]), key) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &b.db.pending[i];
+}
+
+// looks up the record of an output, records written in this run first
+bake_dbrec_t *db_get(const char *key)
+{
+    uint64_t h = db_keyhash(key);
+    if(b.db.npending) {
+        bake_dbrec_t **s = db_pending_slot(key, h);
+        if(*s) {
+            return *s;
+        }
+    }
+    return db_mapped(key, h);
+}
+
+// takes ownership of r, a record of the same output written earlier in
+// this run is freed
+void db_put(bake_dbrec_t *r)
+{
+    if((b.db.npending + 1) * 2 > b.db.cappending) {
+        bake_dbrec_t **old = b.db.pending;
+        uint32_t oldcap = b.db.cappending;
+        b.db.cappending = oldcap ? oldcap * 2 : 64;
+        b.db.pending = calloc(b.db.cappending, sizeof(bake_dbrec_t *));
+        for(uint32_t i = 0; i < oldcap; i++) {
+            if(old[i]) {
+                *db_pending_slot(dbrec_key(old[i]),
+                                 db_keyhash(dbrec_key(old[i]))) = old[i];
+            }
+        }
+        free(old);
+    }
+    bake_dbrec_t **s = db_pending_slot(dbrec_key(r), db_keyhash(dbrec_key(r)));
+    if(*s) {
+        free(*s);
+    } else {
+        b.db.npending++;
+    }
+    *s = r;
+}
+
+static void dbinput_fill(bake_dbinput_t *in, bake_stat_t *e, bool hash)
+{
+    in->mtime = e->mtime;
+    in->size = e->size;
+    in->ino = e->ino;
+    in->hash = hash ? stat_hash(e) : 0;
+}
+
+// builds the record of key from the current state of its inputs
+bake_dbrec_t *dbrec_new(const char *key, uint32_t flags, uint64_t sig,
+                        int64_t duration, char **inputs, int n)
+{
+    size_t len = sizeof(bake_dbrec_t) + n * sizeof(bake_dbinput_t) +
+                 strlen(key) + 1;
+    for(int i = 0; i < n; i++) {
+        len += strlen(inputs[i]) + 1;
+    }
+    len = (len + 7) & ~(size_t)7;
+    bake_dbrec_t *r = calloc(1, len);
+    r->len = len;
+    r->ninputs = n;
+    r->flags = flags;
+    r->sig = sig;
+    r->duration = duration;
+    char *str = (char *)&r->inputs[n];
+    r->key = str - (char *)r;
+    strcpy(str, key);
+    str += strlen(key) + 1;
+    for(int i = 0; i < n; i++) {
+        r->inputs[i].path = str - (char *)r;
+        strcpy(str, inputs[i]);
+        str += strlen(inputs[i]) + 1;
+        if(!(flags & DBREC_DIR) || i == 0) {
+            dbinput_fill(&r->inputs[i], stat_cached(inputs[i]),
+                         flags & DBREC_HASHED);
+        }
+    }
+    struct stat statbuf;
+    if(!(flags & (DBREC_DIR | DBREC_EXT)) && stat(key, &statbuf) == 0) {
+        r->out_mtime = stat_mtime(&statbuf);
+        r->out_size = statbuf.st_size;
+        r->out_ino = statbuf.st_ino;
+    }
+    return r;
+}
+
+// true if any input of r changed since r was recorded, in hash mode
+// inputs that were only touched are refreshed in the database so they are
+// not hashed again next time
+bool input_changed(bake_dbrec_t *r, uint32_t i, bool *stale)
+{
+    bake_dbinput_t *in = &r->inputs[i];
+    bake_stat_t *e = stat_cached(dbinput_path(r, i));
+    if(!e->exists) {
+        return true;
+    }
+    if(e->mtime == in->mtime && e->size == in->size && e->ino == in->ino) {
+        return false;
+    }
+    if(!b.cfg.hashrebuild || !(r->flags & DBREC_HASHED)) {
+        return true;
+    }
+    // touched, only the content decides
+    if(stat_hash(e) != in->hash || !e->exists) {
+        return true;
+    }
+    *stale = true;
+    return false;
+}
+
+bool inputs_changed(bake_dbrec_t *r)
+{
+    bool stale = false;
+    for(uint32_t i = 0; i < r->ninputs; i++) {
+        if(input_changed(r, i, &stale)) {
+            return true;
+        }
+    }
+    if(stale) {
+        bake_dbrec_t *fresh = malloc(r->len);
+        memcpy(fresh, r, r->len);
+        for(uint32_t i = 0; i < fresh->ninputs; i++) {
+            dbinput_fill(&fresh->inputs[i],
+                         stat_cached(dbinput_path(fresh, i)), true);
+        }
+        db_put(fresh);
+    }
+    return false;
+}
+
+// true if output is still what the step of r wrote
+bool output_untouched(bake_dbrec_t *r, const char *output)
+{
+    struct stat statbuf = {};
+    if(stat(output, &statbuf) < 0) {
+        if(errno == ENOENT) {
+            return false;
+        };
+        report_error("stat(%s, /* ... */) failed: %s", output, strerror(errno));
+        exit(1);
+    }
+    return stat_mtime(&statbuf) == r->out_mtime &&
+           statbuf.st_size == r->out_size && statbuf.st_ino == r->out_ino;
+}
+
+// an output is up to date if it was built by the same command, nobody
+// touched it since and none of its recorded inputs changed
+bool needs_rebuild(const char *output, uint64_t sig)
+{
+    bake_dbrec_t *r = db_get(output);
+    if(!r || r->sig != sig || !output_untouched(r, output)) {
+        return true;
+    }
+    return inputs_changed(r);
+}
+
+// writes every record into a new file that replaces the old one, so a
+// crash while saving leaves the previous database intact
+void db_save()
+{
+    if(!b.db.npending) {
+        return;
+    }
+    uint32_t cap = b.db.npending + (b.db.map ? b.db.nslots : 0);
+    bake_dbrec_t **recs = malloc(sizeof(bake_dbrec_t *) * cap);
+    uint64_t nrecs = 0;
+    size_t heap = 0;
+    for(uint32_t i = 0; i < b.db.cappending; i++) {
+        if(b.db.pending[i]) {
+            recs[nrecs++] = b.db.pending[i];
+            heap += b.db.pending[i]->len;
+        }
+    }
+    for(uint32_t i = 0; b.db.map && i < b.db.nslots; i++) {
+        if(!b.db.slots[i].hash) {
+            continue;
+        }
+        bake_dbrec_t *r = db_mapped_at(i);
+        if(!r) {
+            continue;
+        }
+        uint64_t h = b.db.slots[i].hash;
+        if(*db_pending_slot(dbrec_key(r), h)) {
+            continue;
+        }
+        // forget outputs (and source dirs) that are gone
+        const char *what =
+            (r->flags & DBREC_DIR) && r->ninputs ? dbinput_path(r, 0) : dbrec_key(r);
+        if(!(r->flags & DBREC_EXT) && access(what, F_OK) != 0) {
+            continue;
+        }
+        recs[nrecs++] = r;
+        heap += r->len;
+    }
+    uint32_t nslots = 16;
+    while(nslots < nrecs * 2) {
+        nslots *= 2;
+    }
+    size_t size =
+        sizeof(bake_dbhdr_t) + nslots * sizeof(bake_dbslot_t) + heap;
+    uint8_t *buf = calloc(1, size);
+    bake_dbhdr_t *hdr = (bake_dbhdr_t *)buf;
+    memcpy(hdr->magic, BAKEDB_MAGIC, 8);
+    hdr->version = BAKEDB_VERSION;
+    hdr->nslots = nslots;
+    hdr->size = size;
+    hdr->nrecs = nrecs;
+    bake_dbslot_t *slots = (bake_dbslot_t *)(buf + sizeof(bake_dbhdr_t));
+    size_t off = sizeof(bake_dbhdr_t) + nslots * sizeof(bake_dbslot_t);
+    for(uint64_t i = 0; i < nrecs; i++) {
+        uint64_t h = db_keyhash(dbrec_key(recs[i]));
+        uint32_t s = h & (nslots - 1);
+        while(slots[s].hash) {
+            s = (s + 1) & (nslots - 1);
+        }
+        slots[s].hash = h;
+        slots[s].off = off;
+        memcpy(buf + off, recs[i], recs[i]->len);
+        off += recs[i]->len;
+    }
+    free(recs);
+
+    char tmp[PATH_MAX];
+    strlcpy(tmp, b.db.path, PATH_MAX);
+    strlcat(tmp, ".tmp", PATH_MAX);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    for(size_t done = 0; ok && done < size;) {
+        ssize_t w = write(fd, buf + done, size - done);
+        if(w < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = w > 0;
+        done += ok ? w : 0;
+    }
+    ok = ok && fsync(fd) == 0;
+    if(fd >= 0) {
+        close(fd);
+    }
+    ok = ok && rename(tmp, b.db.path) == 0;
+    if(!ok) {
+        // not fatal, the next run just has more to rebuild
+        printf("\nwarning: cannot write build database '%s': %s\n", b.db.path,
+               strerror(errno));
+        unlink(tmp);
+    }
+    free(buf);
+}
+
+void db_close()
+{
+    db_save();
+    for(uint32_t i = 0; i < b.db.cappending; i++) {
+        free(b.db.pending[i]);
+    }
+    free(b.db.pending);
+    b.db.pending = NULL;
+    b.db.cappending = b.db.npending = 0;
+    if(b.db.map) {
+        munmap(b.db.map, b.db.mapsize);
+        b.db.map = NULL;
+    }
+}
+
+bool write_all(int fd, const void *buf, size_t len);
+
+// the bakefile as bake uses it (.bake.plan next to the bakefile), a run
+// whose bakefile did not change maps it instead of parsing the toml. it is
+// a header, the words of the plan in the order plan_io() visits them and
+// the strings, each stored once. a string is its offset in the strings + 1,
+// 0 for none
+#define BAKEPLAN_MAGIC "BAKEPLAN"
+// bump it whenever plan_io() visits something else or in another order,
+// only Linux tells plan_key() which bake binary wrote a plan
+#define BAKEPLAN_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nwords;
+    // hash of the bakefile, the bake version, BAKEPLAN_VERSION and on
+    // Linux the size, mtime and inode of the bake binary
+    uint64_t key;
+    uint64_t size;
+} bake_planhdr_t;
+
+// a string of the bakefile, in the blocks that hold them until the plan
+// is written
+char *plan_copy(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    bake_argblock_t *blk = b.plan.blocks;
+    if(!blk || blk->size - blk->used < len) {
+        size_t size = len > 4096 ? len : 4096;
+        blk = malloc(sizeof(bake_argblock_t) + size);
+        blk->next = b.plan.blocks;
+        blk->used = 0;
+        blk->size = size;
+        b.plan.blocks = blk;
+    }
+    char *str = blk->data + blk->used;
+    memcpy(str, s, len);
+    blk->used += len;
+    return str;
+}
+
+// the string of a toml datum, NULL if it is not set
+char *plan_take(toml_datum_t d)
+{
+    if(!d.ok) {
+        return NULL;
+    }
+    char *s = plan_copy(d.u.s);
+    free(d.u.s);
+    return s;
+}
+
+// the strings of a toml array, an empty list if it is not set
+bake_strv_t plan_list(toml_array_t *arr)
+{
+    bake_strv_t v = {};
+    int n = arr ? toml_array_nelem(arr) : 0;
+    v.v = calloc(n + 1, sizeof(char *));
+    for(int i = 0; i < n; i++) {
+        toml_datum_t d = toml_string_at(arr, i);
+        if(d.ok) {
+            v.v[v.n++] = plan_take(d);
+        }
+    }
+    return v;
+}
+
+void plan_word(uint32_t *w)
+{
+    bake_plan_t *pl = &b.plan;
+    if(pl->load) {
+        if(pl->pos < pl->nwords) {
+            *w = pl->words[pl->pos++];
+        } else {
+            pl->bad = true;
+            *w = 0;
+        }
+        return;
+    }
+    if(pl->nwords == pl->capwords) {
+        pl->capwords = pl->capwords ? pl->capwords * 2 : 1024;
+        pl->words = realloc(pl->words, pl->capwords * sizeof(uint32_t));
+    }
+    pl->words[pl->nwords++] = *w;
+}
+
+void plan_int(int *v)
+{
+    uint32_t w = (uint32_t)*v;
+    plan_word(&w);
+    *v = (int)w;
+}
+
+void plan_bool(bool *v)
+{
+    uint32_t w = *v;
+    plan_word(&w);
+    *v = w != 0;
+}
+
+void plan_i64(int64_t *v)
+{
+    uint32_t lo = (uint32_t)*v, hi = (uint32_t)((uint64_t)*v >> 32);
+    plan_word(&lo);
+    plan_word(&hi);
+    *v = (int64_t)((uint64_t)hi << 32 | lo);
+}
+
+// a number of things that follow, each takes at least a word
+void plan_count(int *n)
+{
+    plan_int(n);
+    bake_plan_t *pl = &b.plan;
+    if(pl->load && (*n < 0 || (uint32_t)*n > pl->nwords - pl->pos)) {
+        pl->bad = true;
+        *n = 0;
+    }
+}
+
+// the offset of s in the strings, it is added if it is not there yet
+uint32_t plan_intern(const char *s)
+{
+    bake_plan_t *pl = &b.plan;
+    if(pl->nset * 2 >= pl->capset) {
+        uint32_t *old = pl->set;
+        uint32_t oldcap = pl->capset;
+        pl->capset = oldcap ? oldcap * 2 : 256;
+        pl->set = calloc(pl->capset, sizeof(uint32_t));
+        for(uint32_t i = 0; i < oldcap; i++) {
+            if(!old[i]) {
+                continue;
+            }
+            uint32_t h = strhash(pl->strs + old[i] - 1) & (pl->capset - 1);
+            while(pl->set[h]) {
+                h = (h + 1) & (pl->capset - 1);
+            }
+            pl->set[h] = old[i];
+        }
+        free(old);
+    }
+    uint32_t h = strhash(s) & (pl->capset - 1);
+    while(pl->set[h]) {
+        if(strcmp(pl->strs + pl->set[h] - 1, s) == 0) {
+            return pl->set[h] - 1;
+        }
+        h = (h + 1) & (pl->capset - 1);
+    }
+    size_t len = strlen(s) + 1;
+    if(pl->nstrs + len > pl->capstrs) {
+        pl->capstrs = (pl->nstrs + len) * 2;
+        pl->strs = realloc(pl->strs, pl->capstrs);
+    }
+    uint32_t off = pl->nstrs;
+    memcpy(pl->strs + off, s, len);
+    pl->nstrs += len;
+    pl->set[h] = off + 1;
+    pl->nset++;
+    return off;
+}
+
+void plan_str(char **s)
+{
+    bake_plan_t *pl = &b.plan;
+    uint32_t w = *s && !pl->load ? plan_intern(*s) + 1 : 0;
+    plan_word(&w);
+    if(!pl->load) {
+        return;
+    }
+    if(w > pl->nstrs) {
+        pl->bad = true;
+        w = 0;
+    }
+    *s = w ? pl->strs + w - 1 : NULL;
+}
+
+void plan_strv(bake_strv_t *v)
+{
+    plan_count(&v->n);
+    if(b.plan.load) {
+        v->v = calloc(v->n + 1, sizeof(char *));
+    }
+    for(int i = 0; i < v->n; i++) {
+        plan_str(&v->v[i]);
+    }
+}
+
+void plan_ints(int **v, int *n)
+{
+    plan_count(n);
+    if(b.plan.load) {
+        *v = calloc(*n + 1, sizeof(int));
+    }
+    for(int i = 0; i < *n; i++) {
+        plan_int(&(*v)[i]);
+    }
+}
+
+// writes the bakefile into the plan or reads it back, field by field
+void plan_io()
+{
+    bool load = b.plan.load;
+    bake_config_t *c = &b.cfg;
+    plan_str(&c->cc);
+    plan_str(&c->as);
+    plan_str(&c->ld);
+    plan_bool(&c->hashrebuild);
+    plan_int(&c->jobs);
+    plan_bool(&c->cache);
+    plan_bool(&c->cachecompress);
+    plan_str(&c->cachepath);
+    plan_i64(&c->cachesize);
+    plan_int(&c->batch);
+    plan_strv(&c->workers);
+    plan_str(&c->linkerset);
+    plan_int(&c->linkthreads);
+    plan_bool(&c->splitdwarf);
+    plan_bool(&c->gdbindex);
+    plan_count(&b.projs);
+    if(load) {
+        b.proj = calloc(b.projs + 1, sizeof(bake_project_t));
+    }
+    for(int i = 0; i < b.projs; i++) {
+        bake_project_t *p = &b.proj[i];
+        plan_bool(&p->isexec);
+        plan_bool(&p->islib);
+        plan_str(&p->srcs);
+        plan_str(&p->bindir);
+        plan_strv(&p->ccflags);
+        plan_strv(&p->incflags);
+        plan_strv(&p->ldflags);
+        plan_ints(&p->deps, &p->ndeps);
+        plan_str(&p->binname);
+        plan_str(&p->scrname);
+        plan_str(&p->idname);
+        plan_bool(&p->thin);
+        plan_bool(&p->unity);
+        plan_int(&p->unitybatch);
+        plan_strv(&p->unityexclude);
+        plan_str(&p->pch);
+        plan_int(&p->lto);
+        plan_int(&p->ltojobs);
+        plan_i64(&p->ltocachesize);
+        plan_int(&p->ltocacheexpire);
+        plan_str(&p->pgotrain);
+    }
+    plan_count(&b.exts);
+    if(load) {
+        b.ext = calloc(b.exts + 1, sizeof(bake_ext_t));
+    }
+    for(int i = 0; i < b.exts; i++) {
+        bake_ext_t *e = &b.ext[i];
+        plan_strv(&e->buildcmd);
+        plan_str(&e->loc);
+        plan_str(&e->chdir);
+        plan_str(&e->scrname);
+        plan_str(&e->idname);
+        plan_int(&e->fingerprint);
+        plan_strv(&e->outputs);
+    }
+}
+
+void cleanup_projs();
+void cleanup_exts();
+
+// the lists of the bakefile, the strings belong to the plan
+void plan_drop()
+{
+    cleanup_projs();
+    cleanup_exts();
+    free(b.cfg.workers.v);
+    b.proj = NULL;
+    b.ext = NULL;
+    b.projs = b.exts = 0;
+    b.cfg.workers = (bake_strv_t){};
+}
+
+// the plan in map becomes the bakefile bake builds, false if it is broken
+bool plan_load(uint8_t *map, size_t size, bool mapped)
+{
+    bake_plan_t *pl = &b.plan;
+    bake_planhdr_t *hdr = (bake_planhdr_t *)map;
+    size_t strs = sizeof(bake_planhdr_t) + (size_t)hdr->nwords * 4;
+    if(strs > size || (size > strs && map[size - 1] != 0)) {
+        return false;
+    }
+    pl->load = true;
+    pl->bad = false;
+    pl->pos = 0;
+    pl->words = (uint32_t *)(map + sizeof(bake_planhdr_t));
+    pl->nwords = hdr->nwords;
+    pl->strs = (char *)map + strs;
+    pl->nstrs = size - strs;
+    plan_io();
+    for(int i = 0; i < b.projs; i++) {
+        for(int k = 0; k < b.proj[i].ndeps; k++) {
+            int d = b.proj[i].deps[k];
+            pl->bad |= d < 0 || d >= b.projs + b.exts;
+        }
+    }
+    pl->words = NULL;
+    pl->strs = NULL;
+    if(pl->bad || pl->pos != pl->nwords) {
+        // the bakefile is parsed instead, from a clean slate
+        plan_drop();
+        memset(&b.cfg, 0, sizeof(b.cfg));
+        return false;
+    }
+    pl->map = map;
+    pl->mapsize = size;
+    pl->mapped = mapped;
+    return true;
+}
+
+// what a plan depends on besides the bakefile
+uint64_t plan_seed()
+{
+    uint64_t h = xxh64(VERSION, strlen(VERSION), BAKEPLAN_VERSION);
+#ifdef __linux__
+    // a rebuilt bake may lay out the plan differently
+    struct stat statbuf;
+    if(stat("/proc/self/exe", &statbuf) == 0) {
+        int64_t id[3] = { stat_mtime(&statbuf), statbuf.st_size,
+                          (int64_t)statbuf.st_ino };
+        h = xxh64(id, sizeof(id), h);
+    }
+#endif
+    return h;
+}
+
+// the key of the plan of the bakefile, 0 if it can't be read
+uint64_t plan_key()
+{
+    int fd = open(b.bakefile, O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+    struct stat statbuf;
+    uint64_t h = 0;
+    if(fstat(fd, &statbuf) == 0) {
+        char *buf = malloc(statbuf.st_size + 1);
+        ssize_t n = read(fd, buf, statbuf.st_size);
+        if(n == statbuf.st_size) {
+            h = xxh64(buf, n, plan_seed());
+        }
+        free(buf);
+    }
+    close(fd);
+    return h;
+}
+
+// maps the plan if it was made from the same bakefile
+bool plan_open(uint64_t key)
+{
+    char path[PATH_MAX];
+    bakefile_sibling(".bake.plan", path, PATH_MAX);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat statbuf;
+    if(fstat(fd, &statbuf) < 0 ||
+       (size_t)statbuf.st_size < sizeof(bake_planhdr_t)) {
+        close(fd);
+        return false;
+    }
+    uint8_t *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    bake_planhdr_t *hdr = (bake_planhdr_t *)map;
+    if(memcmp(hdr->magic, BAKEPLAN_MAGIC, 8) != 0 ||
+       hdr->version != BAKEPLAN_VERSION || hdr->key != key ||
+       hdr->size != (uint64_t)statbuf.st_size ||
+       !plan_load(map, statbuf.st_size, true)) {
+        munmap(map, statbuf.st_size);
+        return false;
+    }
+    return true;
+}
+
+// writes the plan of the bakefile that was just parsed, then builds from
+// the plan like a run that maps it
+void plan_save(uint64_t key)
+{
+    bake_plan_t *pl = &b.plan;
+    pl->load = false;
+    pl->words = NULL;
+    pl->strs = NULL;
+    pl->nwords = pl->capwords = pl->nstrs = pl->capstrs = 0;
+    plan_io();
+    size_t size = sizeof(bake_planhdr_t) + (size_t)pl->nwords * 4 + pl->nstrs;
+    uint8_t *buf = malloc(size);
+    bake_planhdr_t *hdr = (bake_planhdr_t *)buf;
+    memcpy(hdr->magic, BAKEPLAN_MAGIC, 8);
+    hdr->version = BAKEPLAN_VERSION;
+    hdr->nwords = pl->nwords;
+    hdr->key = key;
+    hdr->size = size;
+    memcpy(buf + sizeof(bake_planhdr_t), pl->words, (size_t)pl->nwords * 4);
+    memcpy(buf + size - pl->nstrs, pl->strs, pl->nstrs);
+    free(pl->words);
+    free(pl->strs);
+    free(pl->set);
+    pl->set = NULL;
+    pl->capwords = pl->capset = pl->nset = 0;
+    plan_drop();
+    while(pl->blocks) {
+        bake_argblock_t *next = pl->blocks->next;
+        free(pl->blocks);
+        pl->blocks = next;
+    }
+
+    char path[PATH_MAX], tmp[PATH_MAX];
+    bakefile_sibling(".bake.plan", path, PATH_MAX);
+    snprintf(tmp, PATH_MAX, "%s.tmp", path);
+    int fd = key ? open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    bool ok = fd >= 0 && write_all(fd, buf, size);
+    if(fd >= 0) {
+        close(fd);
+    }
+    if(!(ok && rename(tmp, path) == 0)) {
+        // the next run parses the bakefile again
+        unlink(tmp);
+    }
+    if(!plan_load(buf, size, false)) {
+        report_error("cannot read back the plan of %s", b.bakefile);
+    }
+}
+
+void plan_close()
+{
+    plan_drop();
+    if(b.plan.mapped) {
+        munmap(b.plan.map, b.plan.mapsize);
+    } else {
+        free(b.plan.map);
+    }
+    b.plan.map = NULL;
+}
+
+// returns the sources of dir in alphasort order, the listing is kept in
+// the database and dir is only read again once it changed
+char **list_sources(const char *dir, int *n)
+{
+    char key[PATH_MAX];
+    strlcpy(key, dir, PATH_MAX);
+    strlcat(key, "/", PATH_MAX);
+    bake_stat_t *e = stat_cached(dir);
+    bake_dbrec_t *r = db_get(key);
+    if(e->exists && r && (r->flags & DBREC_DIR) && r->ninputs &&
+       r->inputs[0].mtime == e->mtime && r->inputs[0].size == e->size &&
+       r->inputs[0].ino == e->ino) {
+        *n = r->ninputs - 1;
+        char **names = malloc(sizeof(char *) * (*n + 1));
+        for(int i = 0; i < *n; i++) {
+            names[i] = strdup(dbinput_path(r, i + 1));
+        }
+        return names;
+    }
+    struct dirent **list;
+    int64_t start = now_ns();
+    int cnt = scandir(dir, &list, parse_ext, alphasort);
+    if(cnt < 0) {
+        perror("scandir");
         exit(1);
     }
-    char **outs = calloc(bn, sizeof(char *));
-    char **ins = calloc(bn, sizeof(char *));
-    char **neededo = calloc(bn, sizeof(char *));
-    char **neededc = calloc(bn, sizeof(char *));
-    int ind = 0;
-    while(n--) {
-        i++;
-        outs[i] = malloc(PATH_MAX);
-        strlcpy(outs[i], p.bindir, PATH_MAX);
-        strlcat(outs[i], "/", PATH_MAX);
-        strlcat(outs[i], list[n]->d_name, PATH_MAX);
-        outs[i][strlen(outs[i]) - 1] = 'o';
-        ins[i] = malloc(PATH_MAX);
-        strlcpy(ins[i], p.srcs, PATH_MAX);
-        strlcat(ins[i], "/", PATH_MAX);
-        strlcat(ins[i], list[n]->d_name, PATH_MAX);
+    char what[PATH_MAX];
+    snprintf(what, PATH_MAX, "scandir %s", dir);
+    trace_span("bake", what, start, 0, -1);
+    char **names = malloc(sizeof(char *) * (cnt + 1));
+    char **inputs = malloc(sizeof(char *) * (cnt + 1));
+    inputs[0] = (char *)dir;
+    for(int i = 0; i < cnt; i++) {
+        names[i] = strdup(list[i]->d_name);
+        inputs[i + 1] = names[i];
+        free(list[i]);
+    }
+    free(list);
+    db_put(dbrec_new(key, DBREC_DIR, 0, 0, inputs, cnt + 1));
+    free(inputs);
+    *n = cnt;
+    return names;
+}
+
+// the signature of a command is the hash of its full argv, a different
+// signature means the step has to run again
+uint64_t argv_sig(int argc, char **argv)
+{
+    uint64_t h = 0;
+    for(int i = 0; i < argc; i++) {
+        h = xxh64(argv[i], strlen(argv[i]) + 1, h);
+    }
+    return h;
+}
+
+// the strings of a command live in a few blocks that are freed together
+// with it, instead of one allocation per argument
+void args_add(bake_args_t *a, const char *arg)
+{
+    size_t len = strlen(arg) + 1;
+    bake_argblock_t *blk = a->blocks;
+    if(!blk || blk->size - blk->used < len) {
+        size_t size = len > 4096 ? len : 4096;
+        blk = malloc(sizeof(bake_argblock_t) + size);
+        blk->next = a->blocks;
+        blk->used = 0;
+        blk->size = size;
+        a->blocks = blk;
+    }
+    char *str = blk->data + blk->used;
+    memcpy(str, arg, len);
+    blk->used += len;
+    // keep one extra slot so argv is always NULL terminated
+    if(a->argc + 2 > a->cap) {
+        a->cap = a->cap ? a->cap * 2 : 32;
+        a->argv = realloc(a->argv, sizeof(char *) * a->cap);
+    }
+    a->argv[a->argc++] = str;
+    a->argv[a->argc] = NULL;
+}
+
+// adds every string of a list from the bakefile
+void args_add_strv(bake_args_t *a, bake_strv_t v)
+{
+    for(int i = 0; i < v.n; i++) {
+        args_add(a, v.v[i]);
+    }
+}
+
+void args_free(bake_args_t *a)
+{
+    while(a->blocks) {
+        bake_argblock_t *next = a->blocks->next;
+        free(a->blocks);
+        a->blocks = next;
+    }
+    free(a->argv);
+    memset(a, 0, sizeof(*a));
+}
+
+void pool_init()
+{
+    // a remote compile only runs bake-worker send here
+    b.pool.width = b.jobs + b.remote.slots;
+    b.pool.slots = calloc(b.pool.width, sizeof(bake_job_t));
+    b.pool.pollfds = calloc(b.pool.width * 2 + 4, sizeof(struct pollfd));
+}
+
+// makes the idle pool as wide as -j and the worker slots
+void pool_fit()
+{
+    if(b.pool.width != b.jobs + b.remote.slots) {
+        free(b.pool.slots);
+        free(b.pool.pollfds);
+        pool_init();
+    }
+}
+
+// the number of jobs running here is below -j
+bool pool_local_free()
+{
+    return b.pool.running - b.remote.busy < b.jobs;
+}
+
+void pool_reset()
+{
+    b.pool.done = 0;
+    b.pool.total = 0;
+    b.pool.failed = 0;
+    b.pool.estns = b.pool.estbytes = 0;
+}
+
+// appends to the frame that is written next
+void render_add(const char *fmt, ...)
+{
+    bake_render_t *r = &b.render;
+    for(;;) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(r->buf + r->len, r->cap - r->len, fmt, args);
+        va_end(args);
+        if(n < 0) {
+            return;
+        }
+        if(r->len + n < r->cap) {
+            r->len += n;
+            return;
+        }
+        r->cap = (r->len + n + 1) * 2;
+        r->buf = realloc(r->buf, r->cap);
+    }
+}
+
+// moves back over the frame on screen and clears it
+void render_erase()
+{
+    if(b.render.lines > 1) {
+        render_add("\r\033[%dA\033[J", b.render.lines - 1);
+    } else if(b.render.lines) {
+        render_add("\r\033[J");
+    }
+    b.render.lines = 0;
+}
+
+// writes the frame in one go, after what printf still holds
+void render_flush()
+{
+    fflush(stdout);
+    write_all(STDOUT_FILENO, b.render.buf, b.render.len);
+    b.render.len = 0;
+}
+
+// the bar from green to blue, the escapes are made once
+void render_bar(int i, int n)
+{
+    static char grad[RENDER_BAR][24];
+    if(!grad[0][0]) {
+        for(int k = 0; k < RENDER_BAR; k++) {
+            // #b9f27c to #7da6ff
+            int t = k * 256 / RENDER_BAR;
+            snprintf(grad[k], sizeof(grad[k]), "\033[38;2;%d;%d;%dm",
+                     0xb9 + (0x7d - 0xb9) * t / 256,
+                     0xf2 + (0xa6 - 0xf2) * t / 256,
+                     0x7c + (0xff - 0x7c) * t / 256);
+        }
+    }
+    int c = n ? (int)((int64_t)i * RENDER_BAR / n) : RENDER_BAR;
+    render_add("\033[38;5;2m[\033[0m\033[1m");
+    for(int k = 0; k < c; k++) {
+        render_add("%s=", grad[k]);
+    }
+    if(c < RENDER_BAR) {
+        render_add("%s>", grad[c]);
+    }
+    render_add("\033[0m%*s\033[38;5;4m]\033[0m", RENDER_BAR - c - (c < RENDER_BAR),
+               "");
+}
+
+// the bar and under it the jobs that are running, with how long they run,
+// drawn over the last frame. none of it wider than the terminal, a wrapped
+// line would throw the redraw off
+void render_frame()
+{
+    bake_render_t *r = &b.render;
+    struct winsize ws;
+    int cols = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col ?
+                   ws.ws_col :
+                   80;
+    int rows = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row ?
+                   ws.ws_row :
+                   24;
+    render_erase();
+    render_add("    \033[1m\033[38;5;4mCompiling \033[0m");
+    render_bar(b.pool.done, b.pool.total);
+    render_add("\033[1m %d/%d\033[22m", b.pool.done, b.pool.total);
+    int lines = 1, shown = 0, max = rows / 2 < RENDER_JOBS ? rows / 2 :
+                                                              RENDER_JOBS;
+    int64_t now = now_ns();
+    for(int i = 0; i < b.pool.width; i++) {
+        bake_job_t *j = &b.pool.slots[i];
+        if(!j->pid || !j->name) {
+            continue;
+        }
+        if(shown == max) {
+            render_add("\n      ... %d more", b.pool.running - shown);
+            lines++;
+            break;
+        }
+        int room = cols - 16;
+        if(room < 8) {
+            break;
+        }
+        int len = (int)strlen(j->name);
+        const char *name = len > room ? j->name + len - room : j->name;
+        render_add("\n      %5.1fs %s", (double)(now - j->start) / 1e9, name);
+        lines++;
+        shown++;
+    }
+    r->lines = lines;
+    r->last = now;
+    r->dirty = false;
+    render_flush();
+}
+
+// ms until the next frame is due, -1 if there is nothing to draw. the
+// times of the running jobs change even when nothing else does
+int render_due()
+{
+    bake_render_t *r = &b.render;
+    if(!r->on || !r->tty || (!b.pool.running && !r->dirty)) {
+        return -1;
+    }
+    int64_t left = r->last + RENDER_NS - now_ns();
+    return left > 0 ? (int)(left / 1000000) + 1 : 0;
+}
+
+// draws a frame once one is due, at most every RENDER_NS
+void render_tick()
+{
+    if(render_due() == 0) {
+        render_frame();
+    }
+}
+
+// looks at what stdout is, TERM=dumb can't move the cursor
+void render_init()
+{
+    const char *term = getenv("TERM");
+    b.render.tty = isatty(STDOUT_FILENO) && !(term && strcmp(term, "dumb") == 0);
+    styl_on = b.render.tty;
+}
+
+// starts drawing the progress of a build
+void render_start()
+{
+    b.render.on = true;
+    b.render.dirty = true;
+    b.render.last = 0;
+}
+
+// ends the progress frame, so the next message gets its own line
+void progressbreak()
+{
+    if(b.render.lines) {
+        render_erase();
+        render_flush();
+        b.render.dirty = true;
+    }
+}
+
+// the build is over, its frame goes away
+void render_stop()
+{
+    progressbreak();
+    b.render.on = false;
+}
+
+
+void status(int color, const char *verb, const char *name)
+{
+    progressbreak();
+    tab();
+    styl_set_bold(true);
+    styl_set_color(color);
+    printf("%s ", verb);
+    styl_reset();
+    printf("%s\n", name);
+}
+
+// a failed project takes everything that depends on it down with it
+void proj_skip(int i)
+{
+    bake_node_t *n = &b.node[i];
+    if(n->state == PROJ_FAILED || n->state == PROJ_SKIPPED) {
+        return;
+    }
+    n->state = PROJ_SKIPPED;
+    for(int k = 0; k < n->nrdeps; k++) {
+        proj_skip(n->rdeps[k]);
+    }
+}
+
+// a compile or the link of i failed, the projects that need it are
+// skipped
+void proj_fail(int i)
+{
+    bake_node_t *n = &b.node[i];
+    if(n->state == PROJ_FAILED) {
+        return;
+    }
+    n->state = PROJ_FAILED;
+    for(int k = 0; k < n->nrdeps; k++) {
+        proj_skip(n->rdeps[k]);
+    }
+}
+
+void plan_project(int pi);
+
+void proj_done(int i)
+{
+    bake_node_t *n = &b.node[i];
+    n->state = PROJ_DONE;
+    status(27, i < b.projs ? "Finished" : "Finished external", n->name);
+    for(int k = 0; k < n->nrdeps; k++) {
+        b.node[n->rdeps[k]].waiting--;
+    }
+    for(int k = 0; k < n->nstarts; k++) {
+        bake_node_t *dep = &b.node[n->starts[k]];
+        if(--dep->extwaiting == 0 && dep->state == PROJ_COMPILING) {
+            status(2, "Building", dep->name);
+            plan_project(n->starts[k]);
+        }
+    }
+}
+
+void job_free(bake_job_t *j)
+{
+    args_free(&j->args);
+    args_free(&j->next);
+    for(int k = 0; k < 2; k++) {
+        // a job that never started has no pipes
+        if(j->pid && j->capture[k].fd >= 0) {
+            close(j->capture[k].fd);
+        }
+        free(j->capture[k].buf);
+    }
+    free(j->name);
+    free(j->out);
+    for(int i = 0; i < j->nins; i++) {
+        free(j->ins[i]);
+    }
+    free(j->ins);
+    free(j->cwd);
+    if(j->batch) {
+        for(int i = 0; i < j->batch->n; i++) {
+            free(j->batch->srcs[i]);
+            free(j->batch->outs[i]);
+        }
+        free(j->batch->srcs);
+        free(j->batch->outs);
+        free(j->batch->sigs);
+        free(j->batch);
+    }
+    memset(j, 0, sizeof(bake_job_t));
+}
+
+void compileprogress(char *name, int i, int n, bool ok);
+
+// finds cmd in $PATH like execvp does, returns false if it is not there
+bool find_program(const char *cmd, char *out)
+{
+    if(strchr(cmd, '/')) {
+        return realpath(cmd, out) != NULL;
+    }
+    const char *path = getenv("PATH");
+    if(!path) {
+        path = "/usr/bin:/bin";
+    }
+    while(*path) {
+        const char *end = strchr(path, ':');
+        size_t len = end ? (size_t)(end - path) : strlen(path);
+        char cand[PATH_MAX];
+        snprintf(cand, PATH_MAX, "%.*s/%s", (int)len, path, cmd);
+        if(access(cand, X_OK) == 0 && realpath(cand, out)) {
+            return true;
+        }
+        path += len + (end != NULL);
+    }
+    return false;
+}
+
+void mkdir_p(const char *dir)
+{
+    char tmp[PATH_MAX];
+    strlcpy(tmp, dir, PATH_MAX);
+    for(char *c = tmp + 1; *c; c++) {
+        if(*c == '/') {
+            *c = 0;
+            mkdir(tmp, 0755);
+            *c = '/';
+        }
+    }
+    mkdir(tmp, 0755);
+}
+
+bool read_all(int fd, void *buf, size_t len)
+{
+    for(size_t done = 0; done < len;) {
+        ssize_t r = read(fd, (char *)buf + done, len - done);
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            return false;
+        }
+        done += r;
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *buf, size_t len)
+{
+    for(size_t done = 0; done < len;) {
+        ssize_t w = write(fd, (const char *)buf + done, len - done);
+        if(w < 0 && errno == EINTR) {
+            continue;
+        }
+        if(w <= 0) {
+            return false;
+        }
+        done += w;
+    }
+    return true;
+}
+
+// copies through a temporary file, so a half written copy is never seen
+bool copy_file(const char *from, const char *to)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, PATH_MAX, "%s.tmp.%d", to, (int)getpid());
+    int in = open(from, O_RDONLY);
+    if(in < 0) {
+        return false;
+    }
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0) {
+        close(in);
+        return false;
+    }
+    char buf[65536];
+    bool ok = true;
+    for(;;) {
+        ssize_t r = read(in, buf, sizeof(buf));
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            ok = r == 0;
+            break;
+        }
+        for(ssize_t done = 0; ok && done < r;) {
+            ssize_t w = write(out, buf + done, r - done);
+            if(w < 0 && errno == EINTR) {
+                continue;
+            }
+            ok = w > 0;
+            done += ok ? w : 0;
+        }
+        if(!ok) {
+            break;
+        }
+    }
+    close(in);
+    ok = close(out) == 0 && ok;
+    ok = ok && rename(tmp, to) == 0;
+    if(!ok) {
+        unlink(tmp);
+    }
+    return ok;
+}
+
+void history_add(char kind, bake_job_t *j, int64_t duration)
+{
+    // what a compile time means: a cache hit did not compile anything and
+    // the sources of a batch share the time of their cc
+    const char *cache = j->batch                 ? "batch"
+                        : j->stage == JOB_RUN    ? "-"
+                        : j->stage == JOB_REMOTE ? "remote"
+                        : j->stage == JOB_CC     ? "miss"
+                                                 : "hit";
+    if(kind == 'l') {
+        cache = "-";
+    }
+    char line[PATH_MAX + 256];
+    int len = snprintf(line, sizeof(line), "%c\t%s\t%lld\t%lld\t%lld\t%s\t%s\n",
+                       kind, cache, (long long)duration, (long long)j->cpu,
+                       (long long)j->maxrss, b.node[j->proj].name, j->out);
+    if(len >= (int)sizeof(line)) {
+        return;
+    }
+    if(b.history.len + len > b.history.cap) {
+        b.history.cap = (b.history.cap + len) * 2;
+        b.history.buf = realloc(b.history.buf, b.history.cap);
+    }
+    memcpy(b.history.buf + b.history.len, line, len);
+    b.history.len += len;
+}
+
+// drops the older half of the runs in path
+void history_trim(const char *path, size_t size)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return;
+    }
+    char *buf = malloc(size + 1);
+    bool ok = read_all(fd, buf, size);
+    close(fd);
+    buf[ok ? size : 0] = 0;
+    char *keep = ok ? strstr(buf + size / 2, "\nrun\t") : NULL;
+    if(keep) {
+        char tmp[PATH_MAX];
+        snprintf(tmp, PATH_MAX, "%s.tmp", path);
+        keep++;
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = fd >= 0 && write_all(fd, keep, buf + size - keep);
+        ok = fd >= 0 && close(fd) == 0 && ok;
+        if(!ok || rename(tmp, path) != 0) {
+            unlink(tmp);
+        }
+    }
+    free(buf);
+}
+
+// appends the compiles and links of the build that just ended
+void history_flush()
+{
+    if(!b.history.len) {
+        return;
+    }
+    char path[PATH_MAX], run[128];
+    bakefile_sibling(".bake.history", path, PATH_MAX);
+    int runlen = snprintf(run, sizeof(run), "run\t%lld\t%d\n",
+                          (long long)time(NULL), b.pool.width);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    // one write, so a run is never torn apart by another bake appending
+    char *buf = malloc(runlen + b.history.len);
+    memcpy(buf, run, runlen);
+    memcpy(buf + runlen, b.history.buf, b.history.len);
+    struct stat statbuf;
+    if(fd < 0 || !write_all(fd, buf, runlen + b.history.len)) {
+        // not fatal, the build itself is fine
+        printf("warning: cannot write build history '%s': %s\n", path,
+               strerror(errno));
+    } else if(fstat(fd, &statbuf) == 0 && statbuf.st_size > HISTORY_MAX) {
+        history_trim(path, statbuf.st_size);
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+    free(buf);
+    b.history.len = 0;
+}
+
+// the compiler is identified by its resolved path, size and mtime, the
+// same compiler check ccache does by default
+uint64_t cache_identity()
+{
+    if(b.cache.identity) {
+        return b.cache.identity;
+    }
+    char path[PATH_MAX];
+    if(!find_program(b.cfg.cc, path)) {
+        strlcpy(path, b.cfg.cc, PATH_MAX);
+    }
+    struct stat statbuf = {};
+    stat(path, &statbuf);
+    int64_t id[2] = { statbuf.st_size, stat_mtime(&statbuf) };
+    uint64_t h = xxh64(path, strlen(path) + 1, 0);
+    h = xxh64(id, sizeof(id), h);
+    h = xxh64(b.cwd, strlen(b.cwd) + 1, h);
+    b.cache.identity = h ? h : 1;
+    return b.cache.identity;
+}
+
+// object files and the preprocessed source of a cached compile
+void cache_ifile(const char *oname, char *out)
+{
+    strlcpy(out, oname, PATH_MAX);
+    out[strlen(out) - 1] = 'i';
+}
+
+void cache_entry(const uint64_t key[2], char *out)
+{
+    snprintf(out, PATH_MAX, "%s/%02x/%016llx%016llx.o%s", b.cfg.cachedir,
+             (unsigned)(key[0] >> 56), (unsigned long long)key[0],
+             (unsigned long long)key[1], b.cfg.cachecompress ? ".zst" : "");
+}
+
+bool pgo_input(int pi, const char *obj, char *out);
+
+// the key is the compiler, every flag but the per file outputs, the source
+// path (debug info has it), the profile it is optimized with and the
+// preprocessed source
+bool cache_key(bake_job_t *j, const char *ifile)
+{
+    uint64_t h = cache_identity();
+    char prof[PATH_MAX];
+    if(pgo_input(j->proj, j->out, prof)) {
+        // a dir (no profile for this object) hashes to 0
+        uint64_t ph = 0;
+        hash_file(prof, &ph);
+        h = xxh64(&ph, sizeof(ph), h);
+    }
+    for(int i = 0; i < j->next.argc; i++) {
+        if(i >= j->next.argc - COMPILE_SUFFIX && i != j->next.argc - 1) {
+            continue;
+        }
+        h = xxh64(j->next.argv[i], strlen(j->next.argv[i]) + 1, h);
+    }
+    int fd = open(ifile, O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat statbuf;
+    if(fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return false;
+    }
+    j->key[0] = xxh64(map, statbuf.st_size, h);
+    j->key[1] = xxh64(map, statbuf.st_size, h ^ XXH_P1);
+    munmap(map, statbuf.st_size);
+    return true;
+}
+
+// the job runs args next, it takes ownership of them
+void job_setargs(bake_job_t *j, bake_args_t args)
+{
+    args_free(&j->args);
+    j->args = args;
+}
+
+// moves the command of the next stage in place
+void job_nextstage(bake_job_t *j)
+{
+    job_setargs(j, j->next);
+    memset(&j->next, 0, sizeof(j->next));
+}
+
+void pool_start(bake_job_t j);
+
+// zstd -q -f [-d] -o <to> <from>
+void cache_zstd(bake_job_t *j, bool unpack, const char *from, const char *to)
+{
+    bake_args_t args = {};
+    args_add(&args, "zstd");
+    args_add(&args, "-q");
+    args_add(&args, "-f");
+    if(unpack) {
+        args_add(&args, "-d");
+    }
+    args_add(&args, "-o");
+    args_add(&args, to);
+    args_add(&args, from);
+    job_setargs(j, args);
+}
+
+// a queued compile takes a free worker slot if there is one, otherwise it
+// is compiled here, returns false if it has to wait for a slot
+bool remote_admit(bake_job_t *j)
+{
+    // a worker can't write or read the profile of a pgo project
+    if(j->stage == JOB_CPP && !b.proj[j->proj].pgotrain) {
+        for(int i = 0; i < b.remote.n; i++) {
+            bake_worker_t *w = &b.remote.workers[i];
+            if(!w->down && w->busy < w->slots) {
+                w->busy++;
+                b.remote.busy++;
+                j->worker = i + 1;
+                return true;
+            }
+        }
+    }
+    if(!pool_local_free()) {
+        return false;
+    }
+    if(j->stage == JOB_CPP && !b.cfg.cache) {
+        // only preprocessed for a worker
+        j->stage = JOB_RUN;
+        job_nextstage(j);
+    }
+    return true;
+}
+
+void remote_release(bake_job_t *j)
+{
+    if(j->worker) {
+        b.remote.workers[j->worker - 1].busy--;
+        b.remote.busy--;
+        j->worker = 0;
+    }
+}
+
+// flags of the compile that matter once the source is preprocessed
+static bool remote_flag(char **argv, int *i)
+{
+    static const char *drop[] = { "-MMD", "-MD", "-MP", "-Winvalid-pch", NULL };
+    static const char *droparg[] = { "-MF", "-MT", "-MQ", "-include", "-imacros",
+                                     NULL };
+    for(int k = 0; droparg[k]; k++) {
+        if(strcmp(argv[*i], droparg[k]) == 0) {
+            (*i)++;
+            return false;
+        }
+    }
+    for(int k = 0; drop[k]; k++) {
+        if(strcmp(argv[*i], drop[k]) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// bake-worker send <addr> <identity> <ifile> <object> <flags>
+void remote_start(bake_job_t *j, const char *ifile)
+{
+    bake_worker_t *w = &b.remote.workers[j->worker - 1];
+    bake_args_t args = {};
+    args_add(&args, b.remote.relay);
+    args_add(&args, "send");
+    args_add(&args, w->addr);
+    args_add(&args, b.remote.identity);
+    args_add(&args, ifile);
+    args_add(&args, j->out);
+    bake_args_t *cc = &j->next;
+    for(int i = 1; i < cc->argc - COMPILE_SUFFIX; i++) {
+        if(remote_flag(cc->argv, &i)) {
+            args_add(&args, cc->argv[i]);
+        }
+    }
+    j->stage = JOB_REMOTE;
+    job_setargs(j, args);
+    pool_start(*j);
+}
+
+// runs the compile command in j->next, on the worker j holds a slot of if
+// it is still up
+void job_compile(bake_job_t *j)
+{
+    char ifile[PATH_MAX];
+    cache_ifile(j->out, ifile);
+    if(j->worker && !b.remote.workers[j->worker - 1].down) {
+        remote_start(j, ifile);
+        return;
+    }
+    remote_release(j);
+    unlink(ifile);
+    j->stage = b.cfg.cache ? JOB_CC : JOB_RUN;
+    job_nextstage(j);
+    pool_start(*j);
+}
+
+void cache_compile(bake_job_t *j)
+{
+    b.cache.misses++;
+    job_compile(j);
+}
+
+void cache_store(bake_job_t *j)
+{
+    char entry[PATH_MAX], dir[PATH_MAX];
+    cache_entry(j->key, entry);
+    strlcpy(dir, entry, PATH_MAX);
+    *strrchr(dir, '/') = 0;
+    mkdir_p(dir);
+    if(!b.cfg.cachecompress) {
+        struct stat statbuf;
+        if(copy_file(j->out, entry) && stat(entry, &statbuf) == 0) {
+            b.cache.added += statbuf.st_size;
+        }
+        return;
+    }
+    // compressing runs next to the other jobs
+    bake_job_t pack = { .stage = JOB_PACK, .key = { j->key[0], j->key[1] } };
+    char tmp[PATH_MAX];
+    snprintf(tmp, PATH_MAX, "%s.tmp.%d", entry, (int)getpid());
+    cache_zstd(&pack, false, j->out, tmp);
+    pool_start(pack);
+}
+
+// moves a cached compile on to its next stage, returns true if the job is
+// still running, otherwise *ok is how the compile went
+bool cache_step(bake_job_t *j, bool *ok)
+{
+    char entry[PATH_MAX], ifile[PATH_MAX];
+    switch(j->stage) {
+    case JOB_CPP:
+        cache_ifile(j->out, ifile);
+        bool keyed = *ok && cache_key(j, ifile);
+        if(!keyed) {
+            // the compiler will tell what is wrong
+            remote_release(j);
+            cache_compile(j);
+            return true;
+        }
+        cache_entry(j->key, entry);
+        if(access(entry, R_OK) != 0) {
+            // a worker compiles the same preprocessed source
+            cache_compile(j);
+            return true;
+        }
+        unlink(ifile);
+        remote_release(j);
+        // entries are evicted by mtime, so a hit makes it the newest
+        utimensat(AT_FDCWD, entry, NULL, 0);
+        if(b.cfg.cachecompress) {
+            j->stage = JOB_UNPACK;
+            cache_zstd(j, true, entry, j->out);
+            pool_start(*j);
+            return true;
+        }
+        if(!copy_file(entry, j->out)) {
+            cache_compile(j);
+            return true;
+        }
+        b.cache.hits++;
+        *ok = true;
+        return false;
+    case JOB_UNPACK:
+        if(*ok) {
+            b.cache.hits++;
+            return false;
+        }
+        cache_compile(j);
+        return true;
+    case JOB_CC:
+        if(*ok) {
+            cache_store(j);
+        }
+        return false;
+    case JOB_PACK:
+        cache_entry(j->key, entry);
+        snprintf(ifile, PATH_MAX, "%s.tmp.%d", entry, (int)getpid());
+        struct stat statbuf;
+        if(*ok && rename(ifile, entry) == 0 && stat(entry, &statbuf) == 0) {
+            b.cache.added += statbuf.st_size;
+        } else {
+            unlink(ifile);
+        }
+        return false;
+    }
+    return false;
+}
+
+// moves a compile that uses a worker on, returns true if the job is still
+// running. after preprocessing it is sent to the worker, a worker that
+// could not compile it is not used anymore and it is compiled here
+bool remote_step(bake_job_t *j, int stat, bool *ok)
+{
+    if(j->stage == JOB_CPP) {
+        if(!*ok) {
+            // the compiler will tell what is wrong
+            remote_release(j);
+        }
+        job_compile(j);
+        return true;
+    }
+    char ifile[PATH_MAX];
+    cache_ifile(j->out, ifile);
+    unlink(ifile);
+    bake_worker_t *w = &b.remote.workers[j->worker - 1];
+    remote_release(j);
+    if(WIFEXITED(stat) && WEXITSTATUS(stat) == REMOTE_UNAVAILABLE) {
+        if(!w->down) {
+            w->down = true;
+            char why[PATH_MAX];
+            snprintf(why, sizeof(why), "worker %s, compiling here", w->addr);
+            status(1, "Lost", why);
+        }
+        b.remote.fallbacks++;
+        j->stage = b.cfg.cache ? JOB_CC : JOB_RUN;
+        job_nextstage(j);
+        pool_start(*j);
+        return true;
+    }
+    b.remote.compiled += *ok;
+    if(*ok && b.cfg.cache) {
+        cache_store(j);
+    }
+    return false;
+}
+
+typedef struct {
+    char *path;
+    int64_t mtime;
+    int64_t size;
+} bake_cacheent_t;
+
+static int cacheent_cmp(const void *a, const void *b_)
+{
+    const bake_cacheent_t *x = a, *y = b_;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+// removes the least recently used entries until the cache is at 90% of
+// its size limit, returns the new size
+int64_t cache_evict()
+{
+    bake_cacheent_t *ents = NULL;
+    int n = 0, cap = 0;
+    int64_t total = 0;
+    int64_t now = time(NULL);
+    for(int i = 0; i < 256; i++) {
+        char dir[PATH_MAX];
+        snprintf(dir, PATH_MAX, "%s/%02x", b.cfg.cachedir, i);
+        DIR *d = opendir(dir);
+        if(!d) {
+            continue;
+        }
+        struct dirent *de;
+        while((de = readdir(d))) {
+            if(de->d_name[0] == '.') {
+                continue;
+            }
+            char path[PATH_MAX];
+            snprintf(path, PATH_MAX, "%s/%s", dir, de->d_name);
+            struct stat statbuf;
+            if(stat(path, &statbuf) < 0) {
+                continue;
+            }
+            if(strstr(de->d_name, ".tmp.")) {
+                // left behind by a bake that was killed
+                if(now - statbuf.st_mtime > 3600) {
+                    unlink(path);
+                }
+                continue;
+            }
+            if(n == cap) {
+                cap = cap ? cap * 2 : 1024;
+                ents = realloc(ents, sizeof(bake_cacheent_t) * cap);
+            }
+            ents[n++] = (bake_cacheent_t){ strdup(path), stat_mtime(&statbuf),
+                                           statbuf.st_size };
+            total += statbuf.st_size;
+        }
+        closedir(d);
+    }
+    qsort(ents, n, sizeof(bake_cacheent_t), cacheent_cmp);
+    for(int i = 0; i < n; i++) {
+        if(total > b.cfg.cachesize / 10 * 9 && unlink(ents[i].path) == 0) {
+            total -= ents[i].size;
+        }
+        free(ents[i].path);
+    }
+    free(ents);
+    return total;
+}
+
+// the size of the cache is kept in <cache dir>/size, so it only has to be
+// walked once it grew over the limit
+void cache_finish()
+{
+    if(!b.cfg.cache) {
+        return;
+    }
+    tab();
+    styl_set_bold(true);
+    styl_set_color(6);
+    printf("Cache ");
+    styl_reset();
+    printf("%d hits, %d misses\n", b.cache.hits, b.cache.misses);
+    int64_t added = b.cache.added;
+    // watch mode counts every build on its own
+    b.cache.hits = b.cache.misses = 0;
+    b.cache.added = 0;
+    if(!added) {
+        return;
+    }
+    char sizefile[PATH_MAX];
+    snprintf(sizefile, PATH_MAX, "%s/size", b.cfg.cachedir);
+    long long size = 0;
+    FILE *f = fopen(sizefile, "r");
+    if(f) {
+        if(fscanf(f, "%lld", &size) != 1) {
+            size = 0;
+        }
+        fclose(f);
+    }
+    size += added;
+    if(size > b.cfg.cachesize) {
+        size = cache_evict();
+    }
+    f = fopen(sizefile, "w");
+    if(f) {
+        fprintf(f, "%lld\n", size);
+        fclose(f);
+    }
+}
+
+// true if cc is clang, also when it is called cc or gcc (macOS)
+bool cc_clang()
+{
+    if(!b.cfg.ccknown) {
+        char cmd[PATH_MAX + 64];
+        snprintf(cmd, sizeof(cmd), "'%s' -dM -E -x c /dev/null 2>/dev/null",
+                 b.cfg.cc);
+        FILE *f = popen(cmd, "r");
+        char line[256];
+        while(f && fgets(line, sizeof(line), f)) {
+            if(strncmp(line, "#define __clang__ ", 18) == 0) {
+                b.cfg.ccclang = true;
+            }
+        }
+        if(f) {
+            pclose(f);
+        }
+        b.cfg.ccknown = true;
+    }
+    return b.cfg.ccclang;
+}
+
+// the first line of what cmd prints, without the newline
+void first_line(const char *cmd, char *out, size_t len)
+{
+    *out = 0;
+    FILE *f = popen(cmd, "r");
+    if(!f) {
+        return;
+    }
+    if(fgets(out, len, f)) {
+        out[strcspn(out, "\n")] = 0;
+    }
+    pclose(f);
+}
+
+// what a worker has to compile with: the version and target of cc. gcc
+// starts its version with the name it was run as, that is left out
+void cc_identity(const char *cc, char *out, size_t len)
+{
+    char cmd[PATH_MAX + 64], version[256], machine[128];
+    snprintf(cmd, sizeof(cmd), "'%s' --version 2>/dev/null", cc);
+    first_line(cmd, version, sizeof(version));
+    const char *base = strrchr(cc, '/');
+    base = base ? base + 1 : cc;
+    size_t blen = strlen(base);
+    char *v = version;
+    if(strncmp(v, base, blen) == 0 && v[blen] == ' ') {
+        v += blen + 1;
+    }
+    snprintf(cmd, sizeof(cmd), "'%s' -dumpmachine 2>/dev/null", cc);
+    first_line(cmd, machine, sizeof(machine));
+    snprintf(out, len, "%s %s", v, machine);
+}
+
+static int remote_try(int family, const struct sockaddr *sa, socklen_t len)
+{
+    int fd = socket(family, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int r = connect(fd, sa, len);
+    if(r != 0 && errno == EINPROGRESS) {
+        struct pollfd p = { .fd = fd, .events = POLLOUT };
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        bool up = poll(&p, 1, REMOTE_TIMEOUT_MS) == 1 &&
+                  getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 &&
+                  !err;
+        r = up ? 0 : -1;
+    }
+    if(r != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+    struct timeval tv = { .tv_sec = REMOTE_TIMEOUT_MS / 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+// unix:<path> or <host>:<port>, a worker that is down should not hold up
+// the build
+int remote_connect(const char *addr)
+{
+    if(strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un un = { .sun_family = AF_UNIX };
+        if(strlcpy(un.sun_path, addr + 5, sizeof(un.sun_path)) >=
+           sizeof(un.sun_path)) {
+            return -1;
+        }
+        return remote_try(AF_UNIX, (struct sockaddr *)&un, sizeof(un));
+    }
+    char host[256];
+    const char *colon = strrchr(addr, ':');
+    if(!colon || (size_t)(colon - addr) >= sizeof(host)) {
+        return -1;
+    }
+    // [::1]:port
+    const char *h = addr;
+    size_t hlen = colon - addr;
+    if(hlen >= 2 && h[0] == '[' && h[hlen - 1] == ']') {
+        h++;
+        hlen -= 2;
+    }
+    memcpy(host, h, hlen);
+    host[hlen] = 0;
+    struct addrinfo hints = { .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if(getaddrinfo(host, colon + 1, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for(struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = remote_try(ai->ai_family, ai->ai_addr, ai->ai_addrlen);
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// asks every worker for its compiler and slots before a build, the pool
+// gets a slot for each one a worker has for cc
+void remote_probe()
+{
+    b.remote.slots = b.remote.busy = 0;
+    if(!b.remote.n) {
+        return;
+    }
+    if(!*b.remote.relay) {
+        // next to bake first, then in PATH
+        char self[PATH_MAX];
+        bool found = false;
+        if(strchr(b.argv[0], '/') && realpath(b.argv[0], self)) {
+            *strrchr(self, '/') = 0;
+            strlcat(self, "/bake-worker", PATH_MAX);
+            found = access(self, X_OK) == 0 &&
+                    strlcpy(b.remote.relay, self, PATH_MAX);
+        }
+        if(!found && !find_program("bake-worker", b.remote.relay)) {
+            *b.remote.relay = 0;
+            status(1, "Not using", "workers, bake-worker is not in PATH");
+            return;
+        }
+    }
+    cc_identity(b.cfg.cc, b.remote.identity, sizeof(b.remote.identity));
+    int up = 0;
+    for(int i = 0; i < b.remote.n; i++) {
+        bake_worker_t *w = &b.remote.workers[i];
+        w->busy = w->slots = 0;
+        w->down = true;
+        int fd = remote_connect(w->addr);
+        char line[1024], why[PATH_MAX + 1100];
+        size_t n = 0;
+        // bake-worker <version> <slots> <identity>
+        while(fd >= 0 && n + 1 < sizeof(line) && read(fd, line + n, 1) == 1 &&
+              line[n] != '\n') {
+            n++;
+        }
+        line[n] = 0;
+        if(fd >= 0) {
+            close(fd);
+        }
+        int version, slots, idoff = 0;
+        if(sscanf(line, "bake-worker\t%d\t%d\t%n", &version, &slots, &idoff) !=
+               2 ||
+           !idoff || version != 1 || slots < 1) {
+            snprintf(why, sizeof(why), "worker %s, it does not answer",
+                     w->addr);
+            status(1, "Not using", why);
+            continue;
+        }
+        if(strcmp(line + idoff, b.remote.identity) != 0) {
+            snprintf(why, sizeof(why), "worker %s, it compiles with %s",
+                     w->addr, line + idoff);
+            status(1, "Not using", why);
+            continue;
+        }
+        w->slots = slots;
+        w->down = false;
+        b.remote.slots += slots;
+        up++;
+    }
+    if(up) {
+        char sum[128];
+        snprintf(sum, sizeof(sum), "%d worker(s) with %d slot(s)", up,
+                 b.remote.slots);
+        status(3, "Using", sum);
+    }
+}
+
+// where the profile of a pgo project goes: the file llvm-profdata writes
+// or the dir of .gcda files gcc reads
+void pgo_profile(bake_project_t p, char *out)
+{
+    snprintf(out, PATH_MAX, "%s/%s.%s", p.bindir, p.binname,
+             cc_clang() ? "profdata" : "gcda");
+}
+
+// how gcc names the .gcda of an object in a -fprofile-generate=<dir>: its
+// absolute path without the extension, / as # and .. as ^
+void pgo_mangle(const char *path, char *out)
+{
+    size_t n = 0;
+    for(const char *c = path; *c && n + 2 < PATH_MAX;) {
+        if(*c == '/') {
+            out[n++] = '#';
+            c++;
+        } else if(c[0] == '.' && c[1] == '.' && (c[2] == '/' || !c[2])) {
+            out[n++] = '^';
+            c += 2;
+        } else {
+            out[n++] = *c++;
+        }
+    }
+    out[n] = 0;
+}
+
+// the gcda gcc looks for when it compiles ./<obj> with -fprofile-use=<dir>
+void pgo_gcda(const char *dir, const char *obj, char *out)
+{
+    char abs[PATH_MAX], mangled[PATH_MAX];
+    snprintf(abs, PATH_MAX, "%s/./%s", b.cwd, obj);
+    char *dot = strrchr(abs, '.');
+    if(dot && !strchr(dot, '/')) {
+        *dot = 0;
+    }
+    pgo_mangle(abs, mangled);
+    snprintf(out, PATH_MAX, "%s/%s.gcda", dir, mangled);
+}
+
+// the part of the profile an object of project pi is compiled with, false
+// if it is not compiled with one. gcc has a file per object, one that was
+// never run has none and depends on the dir, it may get one next time
+bool pgo_input(int pi, const char *obj, char *out)
+{
+    bake_project_t p = b.proj[pi];
+    if(!p.pgotrain || p.pgogen) {
+        return false;
+    }
+    pgo_profile(p, out);
+    if(access(out, F_OK) != 0) {
+        return false;
+    }
+    if(!cc_clang()) {
+        char gcda[PATH_MAX];
+        pgo_gcda(out, obj, gcda);
+        if(access(gcda, F_OK) == 0) {
+            strlcpy(out, gcda, PATH_MAX);
+        }
+    }
+    return true;
+}
+
+// -fprofile-generate while bake pgo builds the instrumented variant, then
+// -fprofile-use once there is a profile
+void pgo_args(bake_args_t *a, bake_project_t p)
+{
+    if(!p.pgotrain) {
+        return;
+    }
+    char flag[PATH_MAX * 2 + 32], prof[PATH_MAX];
+    if(p.pgogen) {
+        snprintf(flag, sizeof(flag), "-fprofile-generate=%s/%s/raw", b.cwd,
+                 p.bindir);
+        args_add(a, flag);
+        return;
+    }
+    pgo_profile(p, prof);
+    if(access(prof, F_OK) != 0) {
+        return;
+    }
+    // gcc looks for the .gcda by absolute object path anyway
+    snprintf(flag, sizeof(flag), "-fprofile-use=%s/%s", b.cwd, prof);
+    args_add(a, flag);
+    if(!cc_clang()) {
+        // about every function the training did not run
+        args_add(a, "-Wno-missing-profile");
+    }
+}
+
+// bin/<header> includes the real header, the compilers look for the
+// precompiled one next to the file given to -include
+void pch_paths(bake_project_t p, char *stub, char *out)
+{
+    const char *base = strrchr(p.pch, '/');
+    base = base ? base + 1 : p.pch;
+    snprintf(stub, PATH_MAX, "%s/%s", p.bindir, base);
+    snprintf(out, PATH_MAX, "%s%s", stub, cc_clang() ? ".pch" : ".gch");
+}
+
+// records a finished compile with the dependencies the compiler reported
+void compiled(bake_job_t *j)
+{
+    char depfile[PATH_MAX];
+    depfile_for(j->out, depfile);
+    int n;
+    char **deps = parse_depfile(depfile, &n);
+    if(!deps) {
+        // without a record the object is just compiled again next time
+        return;
+    }
+    // paths in the bakefile dir stay relative like the ones of a plain
+    // compile, batches pass absolute ones
+    size_t cwdlen = strlen(b.cwd);
+    for(int i = 0; i < n; i++) {
+        if(strncmp(deps[i], b.cwd, cwdlen) == 0 && deps[i][cwdlen] == '/') {
+            memmove(deps[i], deps[i] + cwdlen + 1,
+                    strlen(deps[i] + cwdlen + 1) + 1);
+        }
+    }
+    if(!j->pch && b.node[j->proj].pch == PCH_READY) {
+        // the depfile leaves out the headers the compiler took from the
+        // precompiled one
+        deps = realloc(deps, sizeof(char *) * (n + 1));
+        char stub[PATH_MAX];
+        deps[n] = malloc(PATH_MAX);
+        pch_paths(b.proj[j->proj], stub, deps[n]);
+        n++;
+    }
+    char prof[PATH_MAX];
+    if(!j->pch && pgo_input(j->proj, j->out, prof)) {
+        // neither is the profile
+        deps = realloc(deps, sizeof(char *) * (n + 1));
+        deps[n++] = strdup(prof);
+    }
+    bake_dbrec_t *r = dbrec_new(j->out, b.cfg.hashrebuild ? DBREC_HASHED : 0,
+                                j->sig, now_ns() - j->start, deps, n);
+    r->cpu = j->cpu;
+    r->maxrss = j->maxrss;
+    db_put(r);
+    history_add('c', j, r->duration);
+    free_deps(deps, n);
+}
+
+static int strp_cmp(const void *a, const void *b_)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b_);
+}
+
+void ext_walk(const char *dir, char ***paths, int *n, int *cap)
+{
+    DIR *d = opendir(dir);
+    if(!d) {
+        return;
+    }
+    struct dirent *de;
+    while((de = readdir(d))) {
+        // skips . and .. and also .git and friends
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        char path[PATH_MAX];
+        snprintf(path, PATH_MAX, "%s/%s", dir, de->d_name);
+        int type = de->d_type;
+        if(type == DT_UNKNOWN) {
+            struct stat statbuf;
+            if(lstat(path, &statbuf) < 0) {
+                continue;
+            }
+            type = S_ISDIR(statbuf.st_mode) ? DT_DIR :
+                   S_ISREG(statbuf.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if(type == DT_DIR) {
+            ext_walk(path, paths, n, cap);
+            continue;
+        }
+        if(type != DT_REG) {
+            continue;
+        }
+        if(*n == *cap) {
+            *cap = *cap ? *cap * 2 : 256;
+            *paths = realloc(*paths, sizeof(char *) * *cap);
+        }
+        (*paths)[(*n)++] = strdup(path);
+    }
+    closedir(d);
+}
+
+// the files the fingerprint of e covers, sorted so the list itself can go
+// into the signature
+char **ext_inputs(bake_ext_t e, int *n)
+{
+    char **paths = NULL;
+    int cap = 0;
+    *n = 0;
+    if(e.fingerprint == EXT_FP_TREE) {
+        ext_walk(e.loc, &paths, n, &cap);
+        qsort(paths, *n, sizeof(char *), strp_cmp);
+        return paths;
+    }
+    int cnt = e.outputs.n;
+    paths = calloc(cnt + 1, sizeof(char *));
+    for(int i = 0; i < cnt; i++) {
+        paths[i] = malloc(PATH_MAX);
+        snprintf(paths[i], PATH_MAX, "%s/%s", e.loc, e.outputs.v[i]);
+    }
+    *n = cnt;
+    return paths;
+}
+
+uint64_t ext_sig(uint64_t cmdsig, char **paths, int n)
+{
+    uint64_t h = cmdsig;
+    for(int i = 0; i < n; i++) {
+        h = xxh64(paths[i], strlen(paths[i]) + 1, h);
+    }
+    return h;
+}
+
+void ext_key(bake_ext_t e, char *key)
+{
+    snprintf(key, PATH_MAX, "ext:%s", e.idname);
+}
+
+// an external with a fingerprint is skipped when its command and the files
+// the fingerprint covers are the same as after its last build
+bool ext_changed(bake_ext_t e, uint64_t cmdsig)
+{
+    char key[PATH_MAX];
+    ext_key(e, key);
+    bake_dbrec_t *r = db_get(key);
+    if(!r) {
+        return true;
+    }
+    int n;
+    char **paths = ext_inputs(e, &n);
+    bool changed = r->sig != ext_sig(cmdsig, paths, n) || inputs_changed(r);
+    free_deps(paths, n);
+    return changed;
+}
+
+// fingerprints an external after its buildcmd ran, the build itself
+// usually writes into loc
+void ext_record(bake_job_t *j)
+{
+    bake_ext_t e = b.ext[j->proj - b.projs];
+    if(e.fingerprint == EXT_FP_NONE) {
+        return;
+    }
+    char key[PATH_MAX];
+    ext_key(e, key);
+    int n;
+    char **paths = ext_inputs(e, &n);
+    for(int i = 0; i < n; i++) {
+        stat_refresh(paths[i]);
+    }
+    bake_dbrec_t *r =
+        dbrec_new(key, DBREC_EXT | (b.cfg.hashrebuild ? DBREC_HASHED : 0),
+                  ext_sig(j->sig, paths, n), now_ns() - j->start, paths, n);
+    r->cpu = j->cpu;
+    r->maxrss = j->maxrss;
+    db_put(r);
+    free_deps(paths, n);
+}
+
+void server_sync();
+
+// writes what a job printed in one piece, so jobs that run at the same time
+// never mix their output
+void job_output(bake_job_t *j)
+{
+    if(!j->capture[0].len && !j->capture[1].len) {
+        return;
+    }
+    progressbreak();
+    fflush(stdout);
+    for(int k = 0; k < 2; k++) {
+        write_all(STDOUT_FILENO + k, j->capture[k].buf, j->capture[k].len);
+        j->capture[k].len = 0;
+    }
+}
+
+// the compiles of the project waited for its precompiled header
+void pch_built(bake_job_t *j, bool ok)
+{
+    bake_node_t *n = &b.node[j->proj];
+    if(ok) {
+        compiled(j);
+        n->pch = PCH_READY;
+    } else {
+        n->pch = PCH_BROKEN;
+        status(1, "Not using", j->name);
+    }
+    if(n->state == PROJ_COMPILING) {
+        plan_project(j->proj);
+    }
+}
+
+// the span of a job stage that just ended
+void trace_job(bake_job_t *j, int tid)
+{
+    static const char *cats[] = { "compile", "cpp",  "unpack", "compile",
+                                  "pack",    "link", "ext",    "remote" };
+    if(!b.trace.on) {
+        return;
+    }
+    bake_node_t *n = &b.node[j->proj];
+    int prev = j->traceprev - 1;
+    if(!j->traceprev && j->stage == JOB_LINK) {
+        prev = n->tracecompile;
+        for(int k = 0; k < n->ndeps; k++) {
+            prev = trace_later(prev, b.node[n->deps[k]].tracedone);
+        }
+    } else if(!j->traceprev && j->stage != JOB_EXT) {
+        prev = n->tracegate;
+    }
+    if(tid > b.trace.nslots) {
+        b.trace.slotlast = realloc(b.trace.slotlast, sizeof(int) * tid);
+        while(b.trace.nslots < tid) {
+            b.trace.slotlast[b.trace.nslots++] = -1;
+        }
+    }
+    if(!j->traceprev) {
+        // queued jobs wait for a free slot too
+        prev = trace_later(prev, b.trace.slotlast[tid - 1]);
+    }
+    const char *cat = j->pch ? "pch" : j->batch ? "batch" : cats[j->stage];
+    int i = trace_span(cat, j->name, j->start, tid, prev);
+    b.trace.spans[i].cpu = j->cpu;
+    b.trace.spans[i].maxrss = j->maxrss;
+    j->traceprev = i + 1;
+    b.trace.slotlast[tid - 1] = i;
+    if(j->stage == JOB_LINK) {
+        n->tracedone = i;
+    } else if(j->stage == JOB_EXT) {
+        n->tracedone = i;
+        for(int k = 0; k < n->nstarts; k++) {
+            b.node[n->starts[k]].tracegate = i;
+        }
+    } else if(j->pch) {
+        n->tracegate = i;
+    } else {
+        n->tracecompile = i;
+    }
+}
+
+bake_args_t project_prefix(int pi);
+void compile(int proj, char *name, char *oname, bake_args_t args);
+bake_args_t compile_args(bake_args_t *prefix,
+                         char sfx[COMPILE_SUFFIX][PATH_MAX]);
+void compile_suffix(char *name, char *oname, char sfx[COMPILE_SUFFIX][PATH_MAX]);
+
+// moves the objects of a batch into bin. after a failed batch every source
+// is compiled one by one, that finds the one that failed and a cc that
+// died may have left half written objects
+void batch_finished(bake_job_t *j, bool ok)
+{
+    bake_batch_t *bt = j->batch;
+    bake_args_t prefix = {};
+    int64_t duration = now_ns() - j->start;
+    for(int i = 0; i < bt->n; i++) {
+        char obj[PATH_MAX], dep[PATH_MAX], outdep[PATH_MAX];
+        const char *base = strrchr(bt->outs[i], '/');
+        snprintf(obj, PATH_MAX, "%s/%s", j->cwd,
+                 base ? base + 1 : bt->outs[i]);
+        depfile_for(obj, dep);
+        depfile_for(bt->outs[i], outdep);
+        if(ok && rename(obj, bt->outs[i]) == 0 && rename(dep, outdep) == 0) {
+            bake_job_t one = *j;
+            one.out = bt->outs[i];
+            one.sig = bt->sigs[i];
+            one.start = now_ns() - duration / bt->n;
+            one.cpu = j->cpu / bt->n;
+            compiled(&one);
+            continue;
+        }
+        unlink(obj);
+        unlink(dep);
+        if(!prefix.argv) {
+            prefix = project_prefix(j->proj);
+        }
+        char sfx[COMPILE_SUFFIX][PATH_MAX];
+        compile_suffix(bt->srcs[i], bt->outs[i], sfx);
+        compile(j->proj, bt->srcs[i], bt->outs[i], compile_args(&prefix, sfx));
+    }
+    rmdir(j->cwd);
+    if(prefix.argv) {
+        args_free(&prefix);
+    }
+}
+
+void job_finished(bake_job_t *slot, int stat)
+{
+    if(b.server.on || b.watch.on) {
+        // drop what the job wrote from the stat cache before its outputs
+        // are looked at
+        server_sync();
+    }
+    bool ok = !WIFSIGNALED(stat) && !WEXITSTATUS(stat);
+    // the slot is free again, a next stage may take it
+    bake_job_t job = *slot;
+    bake_job_t *j = &job;
+    trace_job(j, slot - b.pool.slots + 1);
+    memset(slot, 0, sizeof(bake_job_t));
+    b.pool.running--;
+    if(j->batch && !ok) {
+        // the compiles it falls back to say which source it was
+        j->capture[0].len = j->capture[1].len = 0;
+    }
+    job_output(j);
+    if(j->stage == JOB_LINK || j->stage == JOB_EXT) {
+        if(ok && j->next.argv) {
+            job_nextstage(j);
+            pool_start(*j);
+            return;
+        }
+        if(ok && j->stage == JOB_EXT) {
+            b.ext[j->proj - b.projs].built = true;
+            ext_record(j);
+            proj_done(j->proj);
+        } else if(ok) {
+            bake_dbrec_t *r =
+                dbrec_new(j->out, b.cfg.hashrebuild ? DBREC_HASHED : 0,
+                          j->sig, now_ns() - j->start, j->ins, j->nins);
+            r->cpu = j->cpu;
+            r->maxrss = j->maxrss;
+            db_put(r);
+            history_add('l', j, r->duration);
+            proj_done(j->proj);
+        } else {
+            b.pool.failed++;
+            status(1, "Failed", j->name);
+            proj_fail(j->proj);
+        }
+        job_free(j);
+        return;
+    }
+    if((j->stage == JOB_REMOTE || (j->stage == JOB_CPP && !b.cfg.cache)) &&
+       remote_step(j, stat, &ok)) {
+        return;
+    }
+    if(j->stage != JOB_RUN && cache_step(j, &ok)) {
+        return;
+    }
+    if(j->stage == JOB_PACK) {
+        job_free(j);
+        return;
+    }
+    b.pool.done++;
+    b.node[j->proj].compiling--;
+    compileprogress(j->name, b.pool.done, b.pool.total, ok);
+    if(j->pch) {
+        pch_built(j, ok);
+    } else if(j->batch) {
+        batch_finished(j, ok);
+    } else if(!ok) {
+        b.pool.failed++;
+        status(1, "Failed", j->name);
+        proj_fail(j->proj);
+    } else {
+        compiled(j);
+    }
+    job_free(j);
+}
+
+extern char **environ;
+
+// starts j in a free slot, what it prints goes into pipes until it is done
+void pool_start(bake_job_t j)
+{
+    int slot = 0;
+    while(b.pool.slots[slot].pid) {
+        slot++;
+    }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    int fds[2][2];
+    for(int k = 0; k < 2; k++) {
+        if(pipe(fds[k]) < 0) {
+            report_error("pipe() failed: %s", strerror(errno));
+        }
+        fcntl(fds[k][0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[k][0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[k][1], F_SETFD, FD_CLOEXEC);
+        posix_spawn_file_actions_adddup2(&fa, fds[k][1], STDOUT_FILENO + k);
+        j.capture[k].fd = fds[k][0];
+    }
+    if(j.cwd) {
+        posix_spawn_file_actions_addchdir_np(&fa, j.cwd);
+    }
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    if(b.watch.on || b.server.on) {
+        // its own group, so a cancelled build can kill the compiler
+        // together with cc1 and as
+        sigset_t def;
+        sigemptyset(&def);
+        sigaddset(&def, SIGPIPE);
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setsigmask(&attr, &b.oldmask);
+        posix_spawnattr_setsigdefault(&attr, &def);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                            POSIX_SPAWN_SETSIGMASK |
+                                            POSIX_SPAWN_SETSIGDEF);
+    }
+    j.start = now_ns();
+    j.spawnerr = posix_spawnp(&j.pid, j.args.argv[0], &fa, &attr,
+                              j.args.argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[0][1]);
+    close(fds[1][1]);
+    if(j.spawnerr) {
+        // the next pool_poll() finishes it like a command that exited 127
+        j.pid = -1;
+        for(int k = 0; k < 2; k++) {
+            close(j.capture[k].fd);
+            j.capture[k].fd = -1;
+        }
+    }
+    b.pool.slots[slot] = j;
+    b.pool.running++;
+}
+
+void capture_add(bake_capture_t *c, const char *data, size_t len)
+{
+    if(c->cap - c->len < len) {
+        while(c->cap - c->len < len) {
+            c->cap = c->cap ? c->cap * 2 : 4096;
+        }
+        c->buf = realloc(c->buf, c->cap);
+    }
+    memcpy(c->buf + c->len, data, len);
+    c->len += len;
+}
+
+// reads what is in the pipe, closes it at the end
+void capture_read(bake_capture_t *c)
+{
+    char buf[16384];
+    for(;;) {
+        ssize_t r = read(c->fd, buf, sizeof(buf));
+        if(r > 0) {
+            capture_add(c, buf, r);
+            continue;
+        }
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r < 0 && errno == EAGAIN) {
+            return;
+        }
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+}
+
+// j closed its output, so it exited or is about to
+void job_reap(bake_job_t *j)
+{
+    int stat = 127 << 8;
+    if(j->pid < 0) {
+        char msg[PATH_MAX + 256];
+        int len = snprintf(msg, sizeof(msg), "%s: %s\n", j->args.argv[0],
+                           strerror(j->spawnerr));
+        capture_add(&j->capture[1], msg, len);
+    } else {
+        struct rusage ru = {};
+        while(wait4(j->pid, &stat, 0, &ru) < 0 && errno == EINTR) {
+        }
+        j->cpu += (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+                  (int64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+        int64_t rss = ru.ru_maxrss;
+#ifdef __APPLE__
+        // bytes there, KiB everywhere else
+        rss /= 1024;
+#endif
+        if(rss > j->maxrss) {
+            j->maxrss = rss;
+        }
+    }
+    job_finished(j, stat);
+}
+
+// waits up to timeout ms (-1 for ever) for output of the running jobs and
+// for extra, whose revents are filled in. jobs that closed their output are
+// finished, returns how many. a command that leaves a process behind that
+// holds on to its stdout keeps its job running
+int pool_poll(struct pollfd *extra, int nextra, int timeout)
+{
+    struct pollfd *fds = b.pool.pollfds;
+    int n = 0;
+    bool done = false;
+    for(int i = 0; i < b.pool.width; i++) {
+        bake_job_t *j = &b.pool.slots[i];
+        if(!j->pid) {
+            continue;
+        }
+        done |= j->capture[0].fd < 0 && j->capture[1].fd < 0;
+        for(int k = 0; k < 2; k++) {
+            if(j->capture[k].fd >= 0) {
+                fds[n++] = (struct pollfd){ .fd = j->capture[k].fd,
+                                            .events = POLLIN };
+            }
+        }
+    }
+    if(nextra) {
+        memcpy(fds + n, extra, sizeof(struct pollfd) * nextra);
+    }
+    int due = render_due();
+    if(due >= 0 && (timeout < 0 || due < timeout)) {
+        timeout = due;
+    }
+    if(poll(fds, n + nextra, done ? 0 : timeout) < 0) {
+        for(int i = 0; i < n + nextra; i++) {
+            fds[i].revents = 0;
+        }
+    }
+    if(nextra) {
+        memcpy(extra, fds + n, sizeof(struct pollfd) * nextra);
+    }
+    // the slots are in the same order as above
+    for(int i = 0, f = 0; i < b.pool.width && f < n; i++) {
+        bake_job_t *j = &b.pool.slots[i];
+        for(int k = 0; j->pid && k < 2; k++) {
+            if(j->capture[k].fd < 0) {
+                continue;
+            }
+            if(fds[f++].revents) {
+                capture_read(&j->capture[k]);
+            }
+        }
+    }
+    int finished = 0;
+    for(int i = 0; i < b.pool.width; i++) {
+        bake_job_t *j = &b.pool.slots[i];
+        if(j->pid && j->capture[0].fd < 0 && j->capture[1].fd < 0) {
+            job_reap(j);
+            finished++;
+        }
+    }
+    render_tick();
+    return finished;
+}
+
+bool watch_poll(int timeout);
+void server_poll();
+
+// waits until a job finished, in watch mode also until something changed
+// and in server mode until the client hangs up
+void pool_wait()
+{
+    if(b.watch.on) {
+        watch_poll(-1);
+    } else if(b.server.on) {
+        server_poll();
+    } else {
+        while(!pool_poll(NULL, 0, -1)) {
+        }
+    }
+}
+
+// kills every running job and drops the queued ones, nothing they did is
+// recorded
+void pool_cancel()
+{
+    for(int i = 0; i < b.pool.width; i++) {
+        if(b.pool.slots[i].pid > 0) {
+            kill(-b.pool.slots[i].pid, SIGTERM);
+        }
+    }
+    for(int i = 0; i < b.pool.width; i++) {
+        bake_job_t *j = &b.pool.slots[i];
+        if(!j->pid) {
+            continue;
+        }
+        int stat;
+        while(j->pid > 0 && waitpid(j->pid, &stat, 0) < 0 && errno == EINTR) {
+        }
+        job_free(j);
+    }
+    b.pool.running = 0;
+}
+
+// queues j until the scheduler has a slot for it, the pool takes
+// ownership of the job
+void pool_queue(bake_job_t j)
+{
+    if(b.pool.queued == b.pool.queuecap) {
+        b.pool.queuecap = b.pool.queuecap ? b.pool.queuecap * 2 : 64;
+        b.pool.queue = realloc(b.pool.queue, sizeof(bake_job_t) * b.pool.queuecap);
+    }
+    int i = b.pool.queued++;
+    while(i > 0 && b.pool.queue[(i - 1) / 2].prio < j.prio) {
+        b.pool.queue[i] = b.pool.queue[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    b.pool.queue[i] = j;
+    b.pool.total++;
+}
+
+// takes the queued job with the highest prio, the one the end of the
+// build depends on most
+bake_job_t pool_next()
+{
+    bake_job_t top = b.pool.queue[0];
+    bake_job_t last = b.pool.queue[--b.pool.queued];
+    int i = 0;
+    for(;;) {
+        int c = i * 2 + 1;
+        if(c >= b.pool.queued) {
+            break;
+        }
+        if(c + 1 < b.pool.queued &&
+           b.pool.queue[c + 1].prio > b.pool.queue[c].prio) {
+            c++;
+        }
+        if(b.pool.queue[c].prio <= last.prio) {
+            break;
+        }
+        b.pool.queue[i] = b.pool.queue[c];
+        i = c;
+    }
+    b.pool.queue[i] = last;
+    return top;
+}
+
+// the object of every source in names, in link order
+char **link_objects(bake_project_t p, char **names, int bn)
+{
+    char **objs = calloc(bn, sizeof(char *));
+    for(int i = 0; i < bn; i++) {
+        objs[i] = malloc(PATH_MAX);
+        strlcpy(objs[i], p.bindir, PATH_MAX);
+        strlcat(objs[i], "/", PATH_MAX);
+        strlcat(objs[i], names[i], PATH_MAX);
+        objs[i][strlen(objs[i]) - 1] = 'o';
+    }
+    return objs;
+}
+
+void link_addinput(char ***inputs, int *n, const char *path)
+{
+    struct stat statbuf;
+    if(stat(path, &statbuf) < 0 || !S_ISREG(statbuf.st_mode)) {
+        return;
+    }
+    *inputs = realloc(*inputs, (*n + 1) * sizeof(char *));
+    (*inputs)[(*n)++] = strdup(path);
+}
+
+// libraries the link of p reads that we can see, the archives of its
+// dependencies and whatever -L/-l or plain files in ldflags resolve to.
+// system libraries that are not under a -L dir are not tracked
+char **link_libs(bake_project_t p, int *n)
+{
+    char **libs = NULL;
+    *n = 0;
+    char path[PATH_MAX];
+    for(int i = 0; i < p.ndeps; i++) {
+        int j = p.deps[i];
+        if(j < b.projs && b.proj[j].islib) {
+            strlcpy(path, b.proj[j].bindir, PATH_MAX);
+            strlcat(path, "/", PATH_MAX);
+            strlcat(path, b.proj[j].binname, PATH_MAX);
+            link_addinput(&libs, n, path);
+        }
+    }
+    int ldflag_cnt = p.ldflags.n;
+    for(int i = 0; i < ldflag_cnt; i++) {
+        const char *f = p.ldflags.v[i];
+        if(strncmp(f, "-l", 2) == 0) {
+            const char *name = f + 2;
+            while(*name == ' ') {
+                name++;
+            }
+            // the first -L dir that has the library wins
+            for(int j = 0; j < ldflag_cnt; j++) {
+                const char *d = p.ldflags.v[j];
+                if(strncmp(d, "-L", 2) == 0) {
+                    d += 2;
+                    while(*d == ' ') {
+                        d++;
+                    }
+                    int before = *n;
+                    strlcpy(path, d, PATH_MAX);
+                    strlcat(path, "/", PATH_MAX);
+                    if(*name == ':') {
+                        strlcat(path, name + 1, PATH_MAX);
+                        link_addinput(&libs, n, path);
+                    } else {
+                        strlcat(path, "lib", PATH_MAX);
+                        strlcat(path, name, PATH_MAX);
+                        size_t len = strlen(path);
+                        strlcat(path, ".so", PATH_MAX);
+                        link_addinput(&libs, n, path);
+                        if(*n == before) {
+                            path[len] = '\0';
+                            strlcat(path, ".a", PATH_MAX);
+                            link_addinput(&libs, n, path);
+                        }
+                    }
+                    if(*n != before) {
+                        break;
+                    }
+                }
+            }
+        } else if(*f != '-' && *f != '\0') {
+            link_addinput(&libs, n, f);
+        }
+    }
+    return libs;
+}
+
+// starts the link of project pi, next runs after args if it is set. the
+// job records out once it succeeded
+void link_start(int pi, bake_args_t args, bake_args_t next, char *out,
+                uint64_t sig, char **ins, int nins)
+{
+    status(5, "Linking", b.proj[pi].scrname);
+    b.node[pi].state = PROJ_LINKING;
+    bake_job_t j = { .stage = JOB_LINK,
+                     .args = args,
+                     .next = next,
+                     .name = strdup(b.proj[pi].scrname),
+                     .proj = pi,
+                     .out = strdup(out),
+                     .sig = sig,
+                     .nins = nins,
+                     .ins = ins };
+    pool_start(j);
+}
+
+// the thinlto cache of a project, it outlives the build like the objects
+void lto_cachedir(bake_project_t p, char *out)
+{
+    snprintf(out, PATH_MAX, "%s/%s.lto-cache", p.bindir, p.binname);
+}
+
+// the linker -fuse-ld= in the ldflags of p picks, else the one [config]
+// linker picked, false if neither does
+bool link_fuseld(bake_project_t p, char *out, size_t len)
+{
+    for(int i = 0; i < p.ldflags.n; i++) {
+        if(strncmp(p.ldflags.v[i], "-fuse-ld=", 9) == 0) {
+            strlcpy(out, p.ldflags.v[i] + 9, len);
+            return true;
+        }
+    }
+    if(b.cfg.linker) {
+        strlcpy(out, b.cfg.linker, len);
+        return true;
+    }
+    return false;
+}
+
+// [config] linker: auto takes the fastest one installed, mold, lld, gold,
+// or leaves it to the compiler. the compilers look for ld.<name>, its
+// version goes into the signature of every link
+void linker_pick(const char *want)
+{
+    static const char *names[] = { "mold", "lld", "gold", "bfd", NULL };
+    bool any = strcmp(want, "auto") == 0;
+    char path[PATH_MAX], tool[64];
+    for(int i = 0; names[i]; i++) {
+        if(!any && strcmp(want, names[i]) != 0) {
+            continue;
+        }
+        snprintf(tool, sizeof(tool), "ld.%s", names[i]);
+        if(find_program(tool, path)) {
+            b.cfg.linker = strdup(names[i]);
+            char cmd[PATH_MAX + 32];
+            snprintf(cmd, sizeof(cmd), "'%s' --version 2>/dev/null", path);
+            first_line(cmd, b.cfg.ldversion, sizeof(b.cfg.ldversion));
+            return;
+        }
+        if(!any) {
+            report_error("[config] linker = \"%s\" but there is no %s in PATH",
+                         want, tool);
+        }
+    }
+    if(!any) {
+        report_error("[config] linker must be \"auto\", \"mold\", \"lld\", "
+                     "\"gold\" or \"bfd\", not '%s'",
+                     want);
+    }
+}
+
+// -fuse-ld= of [config] linker, its threads and --gdb-index, unless the
+// ldflags pick another linker
+void link_linker_args(bake_args_t *a, bake_project_t p)
+{
+    char ld[64], flag[128];
+    if(!link_fuseld(p, ld, sizeof(ld))) {
+        return;
+    }
+    if(b.cfg.linker && strcmp(ld, b.cfg.linker) == 0) {
+        snprintf(flag, sizeof(flag), "-fuse-ld=%s", ld);
+        args_add(a, flag);
+    }
+    // lld and mold use every core unless told otherwise, gold only with
+    // --threads and bfd never
+    int n = b.cfg.linkthreads;
+    if(strcmp(ld, "lld") == 0 && n) {
+        snprintf(flag, sizeof(flag), "-Wl,--threads=%d", n);
+        args_add(a, flag);
+    } else if(strcmp(ld, "mold") == 0 && n) {
+        snprintf(flag, sizeof(flag), "-Wl,--thread-count=%d", n);
+        args_add(a, flag);
+    } else if(strcmp(ld, "gold") == 0) {
+        args_add(a, "-Wl,--threads");
+        if(n) {
+            snprintf(flag, sizeof(flag), "-Wl,--thread-count=%d", n);
+            args_add(a, flag);
+        }
+    }
+    if(b.cfg.gdbindex && strcmp(ld, "bfd") != 0) {
+        args_add(a, "-Wl,--gdb-index");
+    }
+}
+
+// what the link of an lto project adds: the codegen jobs and for thin lto
+// the cache, in the syntax of the linker that runs the codegen
+void lto_link_args(bake_args_t *a, bake_project_t p)
+{
+    if(!p.lto) {
+        return;
+    }
+    char flag[PATH_MAX + 64];
+    if(!cc_clang()) {
+        // gcc runs the ltrans jobs itself, auto takes the make jobserver
+        // or every core
+        if(p.ltojobs) {
+            snprintf(flag, sizeof(flag), "-flto=%d", p.ltojobs);
+        } else {
+            strlcpy(flag, "-flto=auto", sizeof(flag));
+        }
+        args_add(a, flag);
+        return;
+    }
+    args_add(a, p.lto == LTO_THIN ? "-flto=thin" : "-flto");
+    if(p.lto != LTO_THIN) {
+        // full lto is a single codegen, nothing to cache or split
+        return;
+    }
+    char dir[PATH_MAX];
+    lto_cachedir(p, dir);
+    mkdir_p(dir);
+#ifdef __APPLE__
+    snprintf(flag, sizeof(flag), "-Wl,-cache_path_lto,%s", dir);
+    args_add(a, flag);
+    snprintf(flag, sizeof(flag), "-Wl,-prune_after_lto,%d",
+             p.ltocacheexpire * 3600);
+    args_add(a, flag);
+    if(p.ltojobs) {
+        snprintf(flag, sizeof(flag), "-Wl,-mllvm,-threads=%d", p.ltojobs);
+        args_add(a, flag);
+    }
+#else
+    // lld unless the ldflags pick a linker, gold and bfd take the same
+    // options through the llvm plugin
+    char ld[PATH_MAX];
+    bool picked = link_fuseld(p, ld, sizeof(ld));
+    bool plugin = picked && (strcmp(ld, "gold") == 0 || strcmp(ld, "bfd") == 0 ||
+                             strcmp(ld, "mold") == 0);
+    if(!picked) {
+        args_add(a, "-fuse-ld=lld");
+    }
+    const char *opt = plugin ? "-Wl,-plugin-opt," : "-Wl,--thinlto-";
+    snprintf(flag, sizeof(flag), "%scache-dir=%s", opt, dir);
+    args_add(a, flag);
+    snprintf(flag, sizeof(flag),
+             "%scache-policy=prune_after=%dh:cache_size_bytes=%lldm", opt,
+             p.ltocacheexpire, (long long)p.ltocachesize);
+    args_add(a, flag);
+    if(p.ltojobs) {
+        snprintf(flag, sizeof(flag), "%sjobs=%d", opt, p.ltojobs);
+        args_add(a, flag);
+    }
+#endif
+}
+
+void linkapp(int pi)
+{
+    bake_project_t p = b.proj[pi];
+    int bn = b.node[pi].bn;
+    bake_args_t args = {};
+    args_add(&args, b.cfg.ld);
+    args_add_strv(&args, p.incflags);
+    args_add_strv(&args, p.ccflags);
+    if(p.ldflags.n > 1 && strcmp(p.ldflags.v[0], "") != 0) {
+        args_add_strv(&args, p.ldflags);
+    }
+    link_linker_args(&args, p);
+    lto_link_args(&args, p);
+    if(p.pgogen) {
+        // links the profile runtime
+        pgo_args(&args, p);
+    }
+    char **objs = link_objects(p, b.node[pi].names, bn);
+    for(int i = 0; i < bn; i++) {
+        args_add(&args, objs[i]);
+    }
+    char out[PATH_MAX];
+    strlcpy(out, p.bindir, PATH_MAX);
+    strlcat(out, "/", PATH_MAX);
+    strlcat(out, p.binname, PATH_MAX);
+    args_add(&args, "-o");
+    args_add(&args, out);
+
+    // the record covers the objects and the libraries we can find, the
+    // signature covers everything else on the command line
+    int nlibs;
+    char **libs = link_libs(p, &nlibs);
+    objs = realloc(objs, (bn + nlibs) * sizeof(char *));
+    memcpy(objs + bn, libs, nlibs * sizeof(char *));
+    free(libs);
+    uint64_t sig = argv_sig(args.argc, args.argv);
+    if(b.cfg.linker) {
+        // a new version of the same linker links again
+        sig = xxh64(b.cfg.ldversion, strlen(b.cfg.ldversion) + 1, sig);
+    }
+    if(needs_rebuild(out, sig)) {
+        link_start(pi, args, (bake_args_t){}, out, sig, objs, bn + nlibs);
+    } else {
+        args_free(&args);
+        for(int i = 0; i < bn + nlibs; i++) {
+            free(objs[i]);
+        }
+        free(objs);
+        proj_done(pi);
+    }
+}
+
+// the archiver of a project, lto objects need one that can read their
+// symbols
+const char *lto_ar(bake_project_t p)
+{
+    char path[PATH_MAX];
+    const char *ar = cc_clang() ? "llvm-ar" : "gcc-ar";
+    return p.lto && find_program(ar, path) ? ar : "ar";
+}
+
+// <ar> <op> <archive> <members...>
+bake_args_t ar_args(const char *ar, const char *op, const char *out,
+                    char **members, int n)
+{
+    bake_args_t args = {};
+    args_add(&args, ar);
+    args_add(&args, op);
+    args_add(&args, out);
+    for(int i = 0; i < n; i++) {
+        args_add(&args, members[i]);
+    }
+    return args;
+}
+
+// an archive that is still what we last wrote only needs its changed
+// members replaced and the ones whose source is gone deleted. anything
+// else gets the archive rebuilt from scratch
+void linklib(int pi)
+{
+    bake_project_t p = b.proj[pi];
+    int bn = b.node[pi].bn;
+    char *out = malloc(PATH_MAX);
+    strlcpy(out, p.bindir, PATH_MAX);
+    strlcat(out, "/", PATH_MAX);
+    strlcat(out, p.binname, PATH_MAX);
+    // thin archives only hold the paths of their members
+    const char *mode = p.thin ? "rcsT" : "rcs";
+    const char *ar = lto_ar(p);
+    char **objs = link_objects(p, b.node[pi].names, bn);
+    char *sigv[] = { (char *)ar, (char *)mode, out };
+    uint64_t sig = argv_sig(3, sigv);
+    bake_args_t args = {}, next = {};
+
+    bake_dbrec_t *r = db_get(out);
+    bool full = !r || r->sig != sig || !output_untouched(r, out);
+    if(!full) {
+        // index the objects by path so the old members can be matched
+        int cap = 16;
+        while(cap < bn * 2) {
+            cap <<= 1;
+        }
+        int *set = malloc(cap * sizeof(int));
+        memset(set, -1, cap * sizeof(int));
+        for(int i = 0; i < bn; i++) {
+            uint32_t h = strhash(objs[i]) & (cap - 1);
+            while(set[h] != -1) {
+                h = (h + 1) & (cap - 1);
+            }
+            set[h] = i;
+        }
+        bool *kept = calloc(bn, sizeof(bool));
+        char **removed = calloc(r->ninputs + 1, sizeof(char *));
+        char **changed = calloc(bn + 1, sizeof(char *));
+        int nremoved = 0, nchanged = 0;
+        bool stale = false;
+        for(uint32_t i = 0; i < r->ninputs; i++) {
+            const char *path = dbinput_path(r, i);
+            uint32_t h = strhash(path) & (cap - 1);
+            int found = -1;
+            while(set[h] != -1) {
+                if(strcmp(objs[set[h]], path) == 0) {
+                    found = set[h];
+                    break;
+                }
+                h = (h + 1) & (cap - 1);
+            }
+            if(found == -1) {
+                removed[nremoved++] = (char *)path;
+            } else {
+                kept[found] = !input_changed(r, i, &stale);
+            }
+        }
+        for(int i = 0; i < bn; i++) {
+            if(!kept[i]) {
+                changed[nchanged++] = objs[i];
+            }
+        }
+        if(p.thin && nremoved) {
+            // ar d can't find members of a thin archive, writing a new
+            // one is cheap anyway
+            full = true;
+        } else if(nremoved) {
+            args = ar_args(ar, "d", out, removed, nremoved);
+            if(nchanged) {
+                next = ar_args(ar, mode, out, changed, nchanged);
+            } else {
+                // d leaves the symbol table alone
+                next = ar_args(ar, "s", out, NULL, 0);
+            }
+        } else if(nchanged) {
+            args = ar_args(ar, mode, out, changed, nchanged);
+        } else if(stale) {
+            // only touched, record the new stats so we stop hashing
+            bake_dbrec_t *fresh =
+                dbrec_new(out, DBREC_HASHED, sig, r->duration, objs, bn);
+            fresh->cpu = r->cpu;
+            fresh->maxrss = r->maxrss;
+            db_put(fresh);
+        }
+        free(set);
+        free(kept);
+        free(removed);
+        free(changed);
+    }
+    if(full) {
+        // ar r would keep members we no longer have
+        if(unlink(out) < 0 && errno != ENOENT) {
+            report_error("unlink(%s) failed: %s", out, strerror(errno));
+        }
+        args = ar_args(ar, mode, out, objs, bn);
+    }
+    if(args.argv) {
+        link_start(pi, args, next, out, sig, objs, bn);
+    } else {
+        for(int i = 0; i < bn; i++) {
+            free(objs[i]);
+        }
+        free(objs);
+        proj_done(pi);
+    }
+    free(out);
+}
+
+// a finished compile, the next frame shows it. without a terminal it is a
+// line of its own, a log has no use for a bar. a failed one only gets the
+// Failed line
+void compileprogress(char *name, int i, int n, bool ok)
+{
+    if(b.render.tty) {
+        b.render.dirty = true;
+        return;
+    }
+    if(!ok) {
+        return;
+    }
+    char what[PATH_MAX + 32];
+    snprintf(what, sizeof(what), "%d/%d %s", i, n, name);
+    status(4, "Compiled", what);
+}
+
+// the part of the compile command every file of a project shares
+bake_args_t compile_prefix(bake_project_t p, const char *pch)
+{
+    bake_args_t args = {};
+    args_add(&args, b.cfg.cc);
+    args_add_strv(&args, p.ccflags);
+    args_add_strv(&args, p.incflags);
+    if(p.lto) {
+        args_add(&args, p.lto == LTO_THIN ? "-flto=thin" : "-flto");
+    }
+    pgo_args(&args, p);
+    if(b.cfg.splitdwarf) {
+        // the debug info goes to <object>.dwo and is not linked
+        args_add(&args, "-gsplit-dwarf");
+    }
+    if(pch) {
+        // gcc silently parses the header when it can't use the precompiled
+        // one, at least say so
+        args_add(&args, "-Winvalid-pch");
+        args_add(&args, "-include");
+        args_add(&args, pch);
+    }
+    args_add(&args, "-MMD");
+    args_add(&args, "-MF");
+    return args;
+}
+
+// the per file part of the compile command
+void compile_suffix(char *name, char *oname, char sfx[COMPILE_SUFFIX][PATH_MAX])
+{
+    strlcpy(sfx[2], ".", PATH_MAX);
+    strlcat(sfx[2], "/", PATH_MAX);
+    strlcat(sfx[2], oname, PATH_MAX);
+    depfile_for(sfx[2], sfx[0]);
+    strlcpy(sfx[1], "-o", PATH_MAX);
+    strlcpy(sfx[3], "-c", PATH_MAX);
+    strlcpy(sfx[4], ".", PATH_MAX);
+    strlcat(sfx[4], "/", PATH_MAX);
+    strlcat(sfx[4], name, PATH_MAX);
+}
+
+// same as argv_sig() of the full command, without building it
+uint64_t compile_sig(uint64_t prefixsig, char sfx[COMPILE_SUFFIX][PATH_MAX])
+{
+    uint64_t h = prefixsig;
+    for(int i = 0; i < COMPILE_SUFFIX; i++) {
+        h = xxh64(sfx[i], strlen(sfx[i]) + 1, h);
+    }
+    return h;
+}
+
+bake_args_t compile_args(bake_args_t *prefix,
+                         char sfx[COMPILE_SUFFIX][PATH_MAX])
+{
+    bake_args_t args = {};
+    for(int i = 0; i < prefix->argc; i++) {
+        args_add(&args, prefix->argv[i]);
+    }
+    for(int i = 0; i < COMPILE_SUFFIX; i++) {
+        args_add(&args, sfx[i]);
+    }
+    return args;
+}
+
+// compile time of a source the build database has no duration for yet,
+// until some object with one was planned. 20us per byte is a few hundred
+// ms for a source of average size
+#define COMPILE_NS_PER_BYTE 20000
+
+// how long compiling src to out takes: what it took last time, or for a
+// new source its size at the rate the others compiled at
+int64_t compile_estimate(const char *src, const char *out)
+{
+    bake_dbrec_t *r = db_get(out);
+    if(r && r->duration > 0) {
+        return r->duration;
+    }
+    int64_t size = stat_cached(src)->size;
+    if(!b.pool.estbytes) {
+        return size * COMPILE_NS_PER_BYTE;
+    }
+    return (int64_t)((double)size * b.pool.estns / b.pool.estbytes);
+}
+
+void compile(int proj, char *name, char *oname, bake_args_t args)
+{
+    bake_job_t j = { .args = args,
+                     .name = strdup(name),
+                     .proj = proj,
+                     .out = strdup(oname),
+                     .sig = argv_sig(args.argc, args.argv),
+                     .prio = compile_estimate(name, oname) +
+                             b.node[proj].tail };
+    // a cache entry or a worker would only have the object, not its .dwo
+    if(!b.cfg.splitdwarf && (b.cfg.cache || b.remote.slots)) {
+        // same command, but -E into <object>.i, it is what the cache key
+        // is made of and what a worker gets
+        char ifile[PATH_MAX];
+        cache_ifile(oname, ifile);
+        bake_args_t cpp = {};
+        for(int i = 0; i < args.argc; i++) {
+            char *arg = args.argv[i];
+            if(i == args.argc - 3) {
+                arg = ifile;
+            } else if(i == args.argc - 2) {
+                arg = "-E";
+            }
+            args_add(&cpp, arg);
+        }
+        j.stage = JOB_CPP;
+        j.next = args;
+        j.args = cpp;
+    }
+    b.node[proj].compiling++;
+    pool_queue(j);
+}
+
+// compile_prefix() of project pi, with its precompiled header once that is
+// built
+bake_args_t project_prefix(int pi)
+{
+    char stub[PATH_MAX], pch[PATH_MAX];
+    if(b.node[pi].pch == PCH_READY) {
+        pch_paths(b.proj[pi], stub, pch);
+        return compile_prefix(b.proj[pi], stub);
+    }
+    return compile_prefix(b.proj[pi], NULL);
+}
+
+// sources per batch compile out of n, spread over the jobs so every core
+// still gets something
+int batch_size(int n)
+{
+    if(!b.cfg.batch || b.cfg.cache || b.cfg.splitdwarf) {
+        // the cache looks at every source on its own, and -gsplit-dwarf
+        // needs the -o of every object for its .dwo
+        return 1;
+    }
+    // batches never go to a worker
+    int per = (n + b.jobs - 1) / b.jobs;
+    return per < b.cfg.batch ? (per > 0 ? per : 1) : b.cfg.batch;
+}
+
+// flags that take a path, in the same arg or the next one
+static const char *path_flags[] = { "-I",         "-iquote",  "-isystem",
+                                    "-idirafter", "-include", "-imacros",
+                                    NULL };
+
+void args_add_abs(bake_args_t *a, const char *flag, const char *path)
+{
+    char arg[PATH_MAX * 2];
+    if(*path == '/') {
+        snprintf(arg, sizeof(arg), "%s%s", flag, path);
+    } else {
+        snprintf(arg, sizeof(arg), "%s%s/%s", flag, b.cwd, path);
+    }
+    args_add(a, arg);
+}
+
+// queues one cc -c for the n sources. it runs in a scratch dir, so the
+// paths in the flags are made absolute. it leaves out -MF, cc names the
+// depfiles after the objects
+void compile_batch(int pi, bake_args_t *prefix, char **srcs, char **outs,
+                   uint64_t *sigs, int n)
+{
+    bake_batch_t *bt = calloc(1, sizeof(bake_batch_t));
+    bt->n = n;
+    bt->srcs = malloc(sizeof(char *) * n);
+    bt->outs = malloc(sizeof(char *) * n);
+    bt->sigs = malloc(sizeof(uint64_t) * n);
+    memcpy(bt->sigs, sigs, sizeof(uint64_t) * n);
+    char dir[PATH_MAX];
+    const char *base = strrchr(outs[0], '/');
+    snprintf(dir, PATH_MAX, "%s/.batch.%s", b.proj[pi].bindir,
+             base ? base + 1 : outs[0]);
+    mkdir(dir, 0755);
+    bake_args_t args = {};
+    args_add(&args, prefix->argv[0]);
+    for(int i = 1; i < prefix->argc - 1; i++) {
+        const char *arg = prefix->argv[i];
+        int k = 0;
+        while(path_flags[k] &&
+              strncmp(arg, path_flags[k], strlen(path_flags[k])) != 0) {
+            k++;
+        }
+        if(!path_flags[k]) {
+            args_add(&args, arg);
+            continue;
+        }
+        const char *path = arg + strlen(path_flags[k]);
+        if(!*path && i + 1 < prefix->argc - 1) {
+            args_add(&args, arg);
+            args_add_abs(&args, "", prefix->argv[++i]);
+            continue;
+        }
+        // "-I ." is one arg in some bakefiles
+        while(*path == ' ') {
+            path++;
+        }
+        args_add_abs(&args, path_flags[k], path);
+    }
+    args_add(&args, "-c");
+    for(int i = 0; i < n; i++) {
+        bt->srcs[i] = strdup(srcs[i]);
+        bt->outs[i] = strdup(outs[i]);
+        args_add_abs(&args, "", srcs[i]);
+        // a crash may have left objects behind, they would look compiled
+        char obj[PATH_MAX], dep[PATH_MAX];
+        base = strrchr(outs[i], '/');
+        snprintf(obj, PATH_MAX, "%s/%s", dir, base ? base + 1 : outs[i]);
+        depfile_for(obj, dep);
+        unlink(obj);
+        unlink(dep);
+    }
+    char name[PATH_MAX];
+    snprintf(name, PATH_MAX, "%s (+%d)", srcs[0], n - 1);
+    bake_job_t j = { .args = args,
+                     .name = strdup(name),
+                     .proj = pi,
+                     .cwd = strdup(dir),
+                     .batch = bt,
+                     .prio = b.node[pi].tail };
+    for(int i = 0; i < n; i++) {
+        j.prio += compile_estimate(srcs[i], outs[i]);
+    }
+    b.node[pi].compiling++;
+    pool_queue(j);
+}
+
+// depth first over the deps of i, appends i to b.order after its deps. a
+// project that is reached again while its deps are visited is a cycle
+void order_visit(int i, int *mark, int *stack, int depth, int *n)
+{
+    if(mark[i] == 2) {
+        return;
+    }
+    stack[depth] = i;
+    if(mark[i] == 1) {
+        int from = 0;
+        while(stack[from] != i) {
+            from++;
+        }
+        char cycle[4096] = "";
+        for(int k = from; k <= depth; k++) {
+            if(k != from) {
+                strlcat(cycle, " -> ", sizeof(cycle));
+            }
+            strlcat(cycle, b.proj[stack[k]].idname, sizeof(cycle));
+        }
+        report_error("dependency cycle: %s", cycle);
+    }
+    mark[i] = 1;
+    bake_node_t *node = &b.node[i];
+    for(int k = 0; k < node->ndeps; k++) {
+        order_visit(node->deps[k], mark, stack, depth + 1, n);
+    }
+    mark[i] = 2;
+    b.order[(*n)++] = i;
+}
+
+void add_edge(int from, int to)
+{
+    bake_node_t *node = &b.node[from];
+    node->deps = realloc(node->deps, sizeof(int) * (node->ndeps + 1));
+    node->deps[node->ndeps++] = to;
+    node->waiting++;
+    bake_node_t *dep = &b.node[to];
+    dep->rdeps = realloc(dep->rdeps, sizeof(int) * (dep->nrdeps + 1));
+    dep->rdeps[dep->nrdeps++] = from;
+}
+
+// how long the link or build of node i took last time, 0 if it has none
+int64_t link_estimate(int i)
+{
+    char key[PATH_MAX];
+    if(i >= b.projs) {
+        ext_key(b.ext[i - b.projs], key);
+    } else if(b.proj[i].isexec || b.proj[i].islib) {
+        snprintf(key, PATH_MAX, "%s/%s", b.proj[i].bindir, b.proj[i].binname);
+    } else {
+        return 0;
+    }
+    bake_dbrec_t *r = db_get(key);
+    return r ? r->duration : 0;
+}
+
+// deps name projects or externals. a project that names externals starts
+// compiling once they are built, one that names none only links after
+// every external is built, like before externals ran in parallel
+void build_graph()
+{
+    b.nodes = b.projs + b.exts;
+    b.node = calloc(b.nodes, sizeof(bake_node_t));
+    for(int i = 0; i < b.nodes; i++) {
+        b.node[i].tracegate = -1;
+        b.node[i].tracecompile = -1;
+        b.node[i].tracedone = -1;
+    }
+    for(int i = 0; i < b.exts; i++) {
+        b.node[b.projs + i].name = b.ext[i].scrname;
+    }
+    for(int i = 0; i < b.projs; i++) {
+        bake_node_t *node = &b.node[i];
+        node->name = b.proj[i].scrname;
+        for(int k = 0; k < b.proj[i].ndeps; k++) {
+            int dep_indx = b.proj[i].deps[k];
+            add_edge(i, dep_indx);
+            if(dep_indx >= b.projs) {
+                node->extwaiting++;
+                bake_node_t *dep = &b.node[dep_indx];
+                dep->starts = realloc(dep->starts, sizeof(int) * (dep->nstarts + 1));
+                dep->starts[dep->nstarts++] = i;
+            }
+        }
+    }
+    for(int i = 0; i < b.projs; i++) {
+        if(b.node[i].extwaiting) {
+            continue;
+        }
+        for(int j = 0; j < b.exts; j++) {
+            add_edge(i, b.projs + j);
+        }
+    }
+    int *mark = calloc(b.nodes, sizeof(int));
+    int *stack = calloc(b.nodes + 1, sizeof(int));
+    b.order = calloc(b.nodes, sizeof(int));
+    int n = 0;
+    // externals have no deps, they come first
+    for(int i = b.projs; i < b.nodes; i++) {
+        order_visit(i, mark, stack, 0, &n);
+    }
+    for(int i = 0; i < b.projs; i++) {
+        order_visit(i, mark, stack, 0, &n);
+    }
+    free(mark);
+    free(stack);
+    // the projects waiting on a node come after it in b.order
+    for(int k = b.nodes - 1; k >= 0; k--) {
+        bake_node_t *node = &b.node[b.order[k]];
+        int64_t after = 0;
+        for(int r = 0; r < node->nrdeps; r++) {
+            int64_t t = b.node[node->rdeps[r]].tail;
+            after = t > after ? t : after;
+        }
+        node->tail = after + link_estimate(b.order[k]);
+    }
+}
+
+// runs the buildcmd of external node i in its own dir, or skips it if its
+// fingerprint did not change
+void ext_start(int i)
+{
+    bake_ext_t e = b.ext[i - b.projs];
+    if(e.buildcmd.n <= 0) {
+        proj_done(i);
+        return;
+    }
+    char bp[PATH_MAX] = { 0 };
+    strlcpy(bp, e.loc, PATH_MAX);
+    strlcat(bp, "/", PATH_MAX);
+    strlcat(bp, e.chdir, PATH_MAX);
+    bake_args_t args = {};
+    args_add_strv(&args, e.buildcmd);
+    uint64_t sig = xxh64(bp, strlen(bp) + 1, argv_sig(args.argc, args.argv));
+    if(e.fingerprint != EXT_FP_NONE ? !ext_changed(e, sig) :
+                                      b.watch.on && e.built) {
+        args_free(&args);
+        proj_done(i);
+        return;
+    }
+    status(2, "Building external", e.scrname);
+    b.node[i].state = PROJ_LINKING;
+    bake_job_t j = { .stage = JOB_EXT,
+                     .args = args,
+                     .name = strdup(e.scrname),
+                     .proj = i,
+                     .sig = sig,
+                     .cwd = strdup(bp) };
+    pool_start(j);
+}
+
+bool unity_excluded(bake_project_t p, const char *name)
+{
+    for(int i = 0; i < p.unityexclude.n; i++) {
+        if(strcmp(p.unityexclude.v[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// writes a source bake generates (unity batches, the stub of a precompiled
+// header). it is only written when its content changed, so what is built
+// from it is not rebuilt for nothing
+bool write_generated(const char *path, const char *src, size_t len)
+{
+    uint64_t sig = xxh64(src, len, 0);
+    if(!needs_rebuild(path, sig)) {
+        return true;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        print_error("cannot write %s: %s", path, strerror(errno));
+        return false;
+    }
+    bool ok = write_all(fd, src, len);
+    close(fd);
+    if(!ok) {
+        print_error("cannot write %s: %s", path, strerror(errno));
+        return false;
+    }
+    stat_refresh(path);
+    db_put(dbrec_new(path, 0, sig, 0, NULL, 0));
+    return true;
+}
+
+// unity builds: the sources of a project are compiled in batches, bake
+// writes bin/unity.<first source> that #includes every source of a batch
+// and compiles that instead. a batch ends after a source whose name hashes
+// to 0 mod unity_batch (or once it is twice that long), so a new or removed
+// file only changes the batch it is in. names and ins are replaced by the
+// batches and the excluded sources
+void unity_plan(bake_project_t p, char ***names, char ***ins, int *n)
+{
+    char dir[PATH_MAX];
+    if(!realpath(p.srcs, dir)) {
+        print_error("realpath(%s) failed: %s", p.srcs, strerror(errno));
+        return;
+    }
+    char **bnames = malloc(sizeof(char *) * (*n + 1));
+    char **bins = malloc(sizeof(char *) * (*n + 1));
+    bool *excluded = calloc(*n + 1, sizeof(bool));
+    int bn = 0, last = -1;
+    for(int i = 0; i < *n; i++) {
+        excluded[i] = unity_excluded(p, (*names)[i]);
+        if(excluded[i]) {
+            bnames[bn] = (*names)[i];
+            bins[bn++] = (*ins)[i];
+        } else {
+            last = i;
+        }
+    }
+    char *src = NULL;
+    size_t len = 0;
+    FILE *f = NULL;
+    int inbatch = 0;
+    for(int i = 0; i <= last; i++) {
+        char *name = (*names)[i];
+        if(excluded[i]) {
+            continue;
+        }
+        if(!f) {
+            f = open_memstream(&src, &len);
+            fprintf(f, "// generated by bake, unity batch of %s\n", p.scrname);
+            bnames[bn] = malloc(PATH_MAX);
+            snprintf(bnames[bn], PATH_MAX, "unity.%s", name);
+            bins[bn] = malloc(PATH_MAX);
+            snprintf(bins[bn], PATH_MAX, "%s/%s", p.bindir, bnames[bn]);
+        }
+        fprintf(f, "#include \"%s/%s\"\n", dir, name);
+        inbatch++;
+        if(i == last || inbatch >= p.unitybatch * 2 ||
+           xxh64(name, strlen(name), 0) % p.unitybatch == 0) {
+            fclose(f);
+            // a batch that can't be written fails to compile
+            write_generated(bins[bn], src, len);
+            free(src);
+            f = NULL;
+            bn++;
+            inbatch = 0;
+        }
+        free(name);
+        free((*ins)[i]);
+    }
+    free(excluded);
+    free(*names);
+    free(*ins);
+    *names = bnames;
+    *ins = bins;
+    *n = bn;
+}
+
+// makes sure the precompiled header of project pi is up to date before
+// its sources are compiled, false if it is built first. it is built with
+// the same command as the sources, so a precompiled header made with other
+// flags is never used, it is rebuilt
+bool pch_plan(int pi)
+{
+    bake_project_t p = b.proj[pi];
+    bake_node_t *n = &b.node[pi];
+    n->pch = PCH_BROKEN;
+    char header[PATH_MAX], stub[PATH_MAX], out[PATH_MAX];
+    if(!realpath(p.pch, header)) {
+        print_error("pch %s: %s", p.pch, strerror(errno));
+        return true;
+    }
+    pch_paths(p, stub, out);
+    char src[PATH_MAX + 128];
+    int len = snprintf(src, sizeof(src),
+                       "// generated by bake, precompiled header of %s\n"
+                       "#include \"%s\"\n",
+                       p.scrname, header);
+    if(!write_generated(stub, src, len)) {
+        return true;
+    }
+    bake_args_t prefix = compile_prefix(p, NULL);
+    char sfx[COMPILE_SUFFIX][PATH_MAX];
+    compile_suffix(stub, out, sfx);
+    bake_args_t args = {};
+    for(int i = 0; i < prefix.argc; i++) {
+        args_add(&args, prefix.argv[i]);
+    }
+    args_free(&prefix);
+    args_add(&args, sfx[0]);
+    args_add(&args, "-x");
+    args_add(&args, "c-header");
+    for(int i = 1; i < COMPILE_SUFFIX; i++) {
+        args_add(&args, sfx[i]);
+    }
+    uint64_t sig = argv_sig(args.argc, args.argv);
+    if(!needs_rebuild(out, sig)) {
+        args_free(&args);
+        n->pch = PCH_READY;
+        return true;
+    }
+    stat_cached(header);
+    bake_job_t j = { .args = args,
+                     .name = strdup(p.pch),
+                     .proj = pi,
+                     .out = strdup(out),
+                     .sig = sig,
+                     .pch = true,
+                     // every compile of the project waits for it
+                     .prio = INT64_MAX };
+    n->pch = PCH_BUILDING;
+    n->compiling++;
+    pool_queue(j);
+    return false;
+}
+
+// a source plan_project() found out of date
+typedef struct {
+    char *src;
+    char *out;
+    uint64_t sig;
+    // what compile_estimate() expects it to take
+    int64_t est;
+} bake_stale_t;
+
+// longest first, by name if that is the same
+static int stale_cmp(const void *a, const void *b_)
+{
+    const bake_stale_t *x = a, *y = b_;
+    if(x->est != y->est) {
+        return x->est < y->est ? 1 : -1;
+    }
+    return strcmp(x->src, y->src);
+}
+
+// queues the compiles project i needs
+void plan_project(int pi)
+{
+    bake_project_t p = b.proj[pi];
+    if(p.pch && b.node[pi].pch == PCH_UNKNOWN && !pch_plan(pi)) {
+        // planned again once the precompiled header is built
+        return;
+    }
+    int bn;
+    char **names = list_sources(p.srcs, &bn);
+    char **ins = calloc(bn, sizeof(char *));
+    for(int i = 0; i < bn; i++) {
+        ins[i] = malloc(PATH_MAX);
+        strlcpy(ins[i], p.srcs, PATH_MAX);
+        strlcat(ins[i], "/", PATH_MAX);
+        strlcat(ins[i], names[i], PATH_MAX);
+    }
+    if(p.unity) {
+        unity_plan(p, &names, &ins, &bn);
+    }
+    int64_t start = now_ns();
+    bake_args_t prefix = project_prefix(pi);
+    uint64_t prefixsig = argv_sig(prefix.argc, prefix.argv);
+    bake_stale_t *stale = calloc(bn, sizeof(bake_stale_t));
+    int nstale = 0;
+    for(int j = 0; j < bn; j++) {
+        char out[PATH_MAX];
+        strlcpy(out, p.bindir, PATH_MAX);
+        strlcat(out, "/", PATH_MAX);
+        strlcat(out, names[j], PATH_MAX);
+        out[strlen(out) - 1] = 'o';
+        char sfx[COMPILE_SUFFIX][PATH_MAX];
+        compile_suffix(ins[j], out, sfx);
+        uint64_t sig = compile_sig(prefixsig, sfx);
+        // stat the source before it is compiled, an edit made while the
+        // compiler runs then still counts as a change next time
+        bake_stat_t *st = stat_cached(ins[j]);
+        bake_dbrec_t *r = db_get(out);
+        if(r && r->duration > 0) {
+            b.pool.estns += r->duration;
+            b.pool.estbytes += st->size;
+        }
+        if(needs_rebuild(out, sig)) {
+            stale[nstale].src = ins[j];
+            stale[nstale].out = strdup(out);
+            stale[nstale++].sig = sig;
+        }
+    }
+    char what[PATH_MAX];
+    snprintf(what, PATH_MAX, "check %s", p.scrname);
+    trace_span("bake", what, start, 0, -1);
+    // the longest compiles start first, and batches are cut so none of
+    // them gets much more than its share of the project
+    int64_t sum = 0;
+    for(int k = 0; k < nstale; k++) {
+        stale[k].est = compile_estimate(stale[k].src, stale[k].out);
+        sum += stale[k].est;
+    }
+    qsort(stale, nstale, sizeof(bake_stale_t), stale_cmp);
+    char **outs = calloc(bn, sizeof(char *));
+    char **srcs = calloc(bn, sizeof(char *));
+    uint64_t *sigs = calloc(bn, sizeof(uint64_t));
+    for(int k = 0; k < nstale; k++) {
+        srcs[k] = stale[k].src;
+        outs[k] = stale[k].out;
+        sigs[k] = stale[k].sig;
+    }
+    // gcc names profiles after the object, a batch compiles it elsewhere
+    int per = p.pgotrain ? 1 : batch_size(nstale);
+    int64_t share = sum / b.jobs;
+    for(int k = 0, n; k < nstale; k += n) {
+        int64_t cost = stale[k].est;
+        for(n = 1; n < per && k + n < nstale; n++) {
+            if(cost + stale[k + n].est > share) {
+                break;
+            }
+            cost += stale[k + n].est;
+        }
+        if(n > 1) {
+            compile_batch(pi, &prefix, srcs + k, outs + k, sigs + k, n);
+            continue;
+        }
+        char sfx[COMPILE_SUFFIX][PATH_MAX];
+        compile_suffix(srcs[k], outs[k], sfx);
+        compile(pi, srcs[k], outs[k], compile_args(&prefix, sfx));
+    }
+    args_free(&prefix);
+    for(int i = 0; i < nstale; i++) {
+        free(outs[i]);
+    }
+    free(outs);
+    free(srcs);
+    free(sigs);
+    free(stale);
+    for(int i = 0; i < bn; i++) {
+        free(ins[i]);
+    }
+    free(ins);
+    // the link needs them once the compiles are done
+    b.node[pi].names = names;
+    b.node[pi].bn = bn;
+}
+
+#define BUILD_OK 0
+#define BUILD_FAILED 1
+// watch mode saw a change while building or the client of a build server
+// hung up
+#define BUILD_CANCELLED 2
+
+// builds every project. compiles of all projects share the pool, a project
+// links once its own compiles are done and its deps are linked
+int build_projects()
+{
+    b.trace.buildstart = now_ns();
+    b.remote.compiled = b.remote.fallbacks = 0;
+    remote_probe();
+    pool_fit();
+    build_graph();
+    pool_reset();
+    for(int k = 0; k < b.nodes; k++) {
+        int i = b.order[k];
+        if(i < b.projs && !b.node[i].extwaiting) {
+            status(2, "Building", b.node[i].name);
+            plan_project(i);
+        }
+    }
+    render_start();
+    for(;;) {
+        // after a failure only -k starts anything new
+        if(!b.pool.failed || b.keepgoing) {
+            // links first, other projects may be waiting on them
+            for(int k = 0; k < b.nodes && pool_local_free(); k++) {
+                int i = b.order[k];
+                bake_node_t *node = &b.node[i];
+                if(node->state != PROJ_COMPILING || node->compiling ||
+                   node->waiting) {
+                    continue;
+                }
+                if(i >= b.projs) {
+                    ext_start(i);
+                } else if(b.proj[i].isexec) {
+                    linkapp(i);
+                } else if(b.proj[i].islib) {
+                    linklib(i);
+                } else {
+                    proj_done(i);
+                }
+            }
+            while(b.pool.queued && b.pool.running < b.pool.width &&
+                  remote_admit(&b.pool.queue[0])) {
+                pool_start(pool_next());
+            }
+        }
+        if(!b.pool.running) {
+            break;
+        }
+        pool_wait();
+        if(b.watch.changed || b.watch.quit || b.server.cancel) {
+            pool_cancel();
+            break;
+        }
+    }
+    render_stop();
+    trace_finish();
+    history_flush();
+    if(b.remote.compiled || b.remote.fallbacks) {
+        char sum[128];
+        snprintf(sum, sizeof(sum), "%d on workers, %d here after a worker failed",
+                 b.remote.compiled, b.remote.fallbacks);
+        status(3, "Compiled", sum);
+    }
+    for(int i = 0; i < b.pool.queued; i++) {
+        job_free(&b.pool.queue[i]);
+    }
+    b.pool.queued = 0;
+    int failed = 0;
+    // projects a failure kept from building, without -k that is every one
+    // that was not done yet
+    int skipped = 0;
+    for(int i = 0; i < b.nodes; i++) {
+        int state = b.node[i].state;
+        failed += state == PROJ_FAILED;
+        skipped += state != PROJ_FAILED && state != PROJ_DONE;
+        free_deps(b.node[i].names, b.node[i].bn);
+        free(b.node[i].deps);
+        free(b.node[i].rdeps);
+        free(b.node[i].starts);
+    }
+    int nodes = b.nodes;
+    free(b.node);
+    free(b.order);
+    b.node = NULL;
+    b.order = NULL;
+    if(b.watch.changed || b.watch.quit || b.server.cancel) {
+        return BUILD_CANCELLED;
+    }
+    if(failed || skipped) {
+        char what[64] = "";
+        if(skipped) {
+            snprintf(what, sizeof(what), ", %d not built", skipped);
+        }
+        if(!b.watch.on && !b.server.on) {
+            report_error("%d of %d project(s) failed to build%s", failed, nodes,
+                         what);
+        }
+        print_error("%d of %d project(s) failed to build%s", failed, nodes, what);
+        return BUILD_FAILED;
+    }
+    return BUILD_OK;
+}
+
+// adds s to the set, returns false if it was in it already
+bool strset_add(bake_strset_t *set, const char *s)
+{
+    if(set->n * 2 >= set->cap) {
+        bake_strset_t old = *set;
+        set->cap = old.cap ? old.cap * 2 : 256;
+        set->ent = calloc(set->cap, sizeof(char *));
+        for(int i = 0; i < old.cap; i++) {
+            if(!old.ent[i])
+                continue;
+            uint32_t j = strhash(old.ent[i]) & (set->cap - 1);
+            while(set->ent[j]) {
+                j = (j + 1) & (set->cap - 1);
+            }
+            set->ent[j] = old.ent[i];
+        }
+        free(old.ent);
+    }
+    uint32_t i = strhash(s) & (set->cap - 1);
+    while(set->ent[i]) {
+        if(strcmp(set->ent[i], s) == 0) {
+            return false;
+        }
+        i = (i + 1) & (set->cap - 1);
+    }
+    set->ent[i] = strdup(s);
+    set->n++;
+    return true;
+}
+
+bool strset_has(bake_strset_t *set, const char *s)
+{
+    if(!set->cap) {
+        return false;
+    }
+    uint32_t i = strhash(s) & (set->cap - 1);
+    while(set->ent[i]) {
+        if(strcmp(set->ent[i], s) == 0) {
+            return true;
+        }
+        i = (i + 1) & (set->cap - 1);
+    }
+    return false;
+}
+
+void strset_clear(bake_strset_t *set)
+{
+    for(int i = 0; i < set->cap; i++) {
+        free(set->ent[i]);
+    }
+    free(set->ent);
+    memset(set, 0, sizeof(*set));
+}
+
+// runs bake again with the same arguments, everything parsed from the
+// bakefile may be different once it changed
+[[noreturn]] void restart()
+{
+    fflush(stdout);
+    db_close();
+    if(b.sigfd) {
+        sigprocmask(SIG_SETMASK, &b.oldmask, NULL);
+    }
+#ifdef __linux__
+    execv("/proc/self/exe", b.argv);
+#else
+    execvp(b.argv[0], b.argv);
+#endif
+    report_error("cannot restart bake: %s", strerror(errno));
+}
+
+#ifdef __linux__
+#define WATCH_EVENTS                                                       \
+    (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+     IN_MOVED_TO)
+// how long the sources have to stay quiet before a rebuild starts, editors
+// and git write several files in a burst
+#define WATCH_SETTLE_MS 30
+
+void signals_init()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &b.oldmask);
+    b.sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(b.sigfd < 0) {
+        report_error("signalfd() failed: %s", strerror(errno));
+    }
+}
+
+void inotify_open()
+{
+    b.watch.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(b.watch.fd < 0) {
+        report_error("inotify_init1() failed: %s", strerror(errno));
+    }
+}
+
+void watch_init()
+{
+    inotify_open();
+    signals_init();
+    b.watch.on = true;
+}
+
+// returns the watch descriptor of dir, -1 if it cannot be watched
+int watch_dir(const char *dir, bool srcs)
+{
+    int wd = inotify_add_watch(b.watch.fd, dir, WATCH_EVENTS);
+    if(wd < 0) {
+        return -1;
+    }
+    if(wd >= b.watch.ndirs) {
+        int n = wd + 16;
+        b.watch.dirs = realloc(b.watch.dirs, sizeof(bake_watchdir_t) * n);
+        memset(b.watch.dirs + b.watch.ndirs, 0,
+               sizeof(bake_watchdir_t) * (n - b.watch.ndirs));
+        b.watch.ndirs = n;
+    }
+    bake_watchdir_t *d = &b.watch.dirs[wd];
+    if(!d->path) {
+        d->path = strdup(dir);
+    }
+    d->srcs |= srcs;
+    return wd;
+}
+
+// watches the dir of path, key is set to "<wd>/<name>" the way events
+// about path are matched. returns the watch descriptor, -1 if the dir
+// cannot be watched
+int watch_key(const char *path, char *key)
+{
+    char dir[PATH_MAX];
+    strlcpy(dir, path, PATH_MAX);
+    char *slash = strrchr(dir, '/');
+    const char *name = path;
+    if(slash) {
+        *slash = 0;
+        name = slash + 1;
+    } else {
+        strlcpy(dir, ".", PATH_MAX);
+    }
+    int wd = watch_dir(dir, false);
+    if(wd >= 0) {
+        snprintf(key, PATH_MAX, "%d/%s", wd, name);
+    }
+    return wd;
+}
+
+// watches path through its dir, editors often replace a file instead of
+// writing to it
+void watch_file(const char *path, char *key)
+{
+    char k[PATH_MAX];
+    if(watch_key(path, k) < 0) {
+        return;
+    }
+    strset_add(&b.watch.files, k);
+    if(key) {
+        strlcpy(key, k, PATH_MAX);
+    }
+}
+
+// watches the srcs dirs, everything the last compile of each object read
+// and the bakefile
+void watch_refresh()
+{
+    watch_file(b.bakefile, b.watch.bakefile);
+    static const char *own[] = { ".bake.db",      ".bake.db.tmp",
+                                 ".bake.plan",    ".bake.plan.tmp",
+                                 ".bake.history", NULL };
+    char path[PATH_MAX], k[PATH_MAX];
+    for(int i = 0; own[i]; i++) {
+        bakefile_sibling(own[i], path, PATH_MAX);
+        if(watch_key(path, k) >= 0) {
+            strset_add(&b.watch.own, k);
+        }
+    }
+    if(b.trace.on && watch_key(b.trace.path, k) >= 0) {
+        strset_add(&b.watch.own, k);
+    }
+    for(int i = 0; i < b.projs; i++) {
+        bake_project_t p = b.proj[i];
+        watch_dir(p.srcs, true);
+        int bn;
+        char **names = list_sources(p.srcs, &bn);
+        char **objs = link_objects(p, names, bn);
+        for(int k = 0; k < bn; k++) {
+            bake_dbrec_t *r = db_get(objs[k]);
+            for(uint32_t in = 0; r && in < r->ninputs; in++) {
+                watch_file(dbinput_path(r, in), NULL);
+            }
+        }
+        free_deps(objs, bn);
+        free_deps(names, bn);
+    }
+}
+
+// reads the pending inotify events and remembers them for stat_sync().
+// returns true if one of them is about a file a build reads
+bool watch_read()
+{
+    bool changed = false;
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;) {
+        ssize_t len = read(b.watch.fd, buf, sizeof(buf));
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len <= 0) {
+            break;
+        }
+        for(char *p = buf; p < buf + len;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            char path[PATH_MAX] = "";
+            char k[PATH_MAX];
+            bool hit = false;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                // lost events, anything may have changed
+                b.watch.overflow = true;
+                hit = true;
+            } else if(ev->wd >= 0 && ev->wd < b.watch.ndirs &&
+                      b.watch.dirs[ev->wd].path && ev->len) {
+                bake_watchdir_t *d = &b.watch.dirs[ev->wd];
+                snprintf(k, PATH_MAX, "%d/%s", ev->wd, ev->name);
+                snprintf(path, PATH_MAX, "%s/%s", d->path, ev->name);
+                strset_add(&b.watch.pending, k);
+                // after a failure anything may be what was missing, except
+                // what bake wrote itself
+                hit = (b.watch.failed && !strset_has(&b.watch.own, k)) ||
+                      (d->srcs && is_source(ev->name)) ||
+                      strset_has(&b.watch.files, k);
+                if(strcmp(k, b.watch.bakefile) == 0) {
+                    b.watch.bakefilechanged = true;
+                }
+            } else if(ev->mask & IN_IGNORED) {
+                // the dir is gone, all of it is watched again once it is
+                // back
+                snprintf(k, PATH_MAX, "%d/", ev->wd);
+                strset_add(&b.watch.pending, k);
+                if(ev->wd < b.watch.ndirs) {
+                    free(b.watch.dirs[ev->wd].path);
+                    b.watch.dirs[ev->wd] = (bake_watchdir_t){};
+                }
+                hit = true;
+            }
+            // a build server only keeps its stat cache in sync
+            if(!b.watch.on) {
+                hit = false;
+            }
+            if(hit && !b.watch.changed) {
+                b.watch.changed = true;
+                strlcpy(b.watch.first, path, PATH_MAX);
+            }
+            changed |= hit;
+        }
+    }
+    return changed;
+}
+
+// waits up to timeout ms (-1 for ever) for the running jobs, a change or
+// a signal to stop. returns true if a file a build reads changed
+bool watch_poll(int timeout)
+{
+    struct pollfd fds[2] = { { .fd = b.watch.fd, .events = POLLIN },
+                             { .fd = b.sigfd, .events = POLLIN } };
+    pool_poll(fds, 2, timeout);
+    if(fds[1].revents & POLLIN) {
+        struct signalfd_siginfo si;
+        while(read(b.sigfd, &si, sizeof(si)) == sizeof(si)) {
+            b.watch.quit = true;
+        }
+    }
+    return (fds[0].revents & POLLIN) && watch_read();
+}
+
+void stat_sync();
+void server_track();
+
+// builds, then rebuilds whenever a source, a header one of them includes or
+// the bakefile changes. the parsed bakefile, the build database and the
+// stat cache stay in memory between builds, inotify tells which paths
+// have to be stat()'d again
+void watch()
+{
+    watch_init();
+    watch_refresh();
+    for(;;) {
+        int r = build_projects();
+        cache_finish();
+        b.watch.failed = r == BUILD_FAILED;
+        if(b.watch.quit) {
+            return;
+        }
+        // save what this build learned, db_open() maps it again
+        db_close();
+        db_open();
+        watch_refresh();
+        server_track();
+        if(r != BUILD_CANCELLED) {
+            status(3, "Watching", "for changes, ^C to stop");
+            while(!b.watch.changed && !b.watch.quit) {
+                watch_poll(-1);
+            }
+        }
+        while(!b.watch.quit && watch_poll(WATCH_SETTLE_MS)) {
+        }
+        if(b.watch.quit) {
+            return;
+        }
+        if(b.watch.bakefilechanged) {
+            // everything may be different, start over with the new one
+            status(3, "Changed", b.bakefile);
+            restart();
+        }
+        status(3, "Changed", b.watch.first[0] ? b.watch.first : "sources");
+        b.watch.changed = false;
+        b.watch.first[0] = 0;
+        // only what changed is stat()'d and hashed again
+        stat_sync();
+    }
+}
+#else
+void watch()
+{
+    report_error("--watch needs inotify, it is only supported on Linux");
+}
+
+bool watch_poll(int timeout)
+{
+    (void)timeout;
+    return false;
+}
+#endif
+
+// the socket of the build server lives next to the bakefile
+bool server_addr(struct sockaddr_un *addr)
+{
+    char path[PATH_MAX];
+    bakefile_sibling(".bake.sock", path, PATH_MAX);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    return strlcpy(addr->sun_path, path, sizeof(addr->sun_path)) <
+           sizeof(addr->sun_path);
+}
+
+int server_connect()
+{
+    struct sockaddr_un addr;
+    if(!server_addr(&addr)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// asks the build server of the bakefile to do op, its output goes straight
+// to our stdout and stderr. returns the exit status of the build, or -1 if
+// no server took the request and bake has to build by itself
+int server_request(int op)
+{
+    int fd = server_connect();
+    if(fd < 0) {
+        return -1;
+    }
+    bake_request_t req = { .magic = SERVER_MAGIC,
+                           .op = op,
+                           .jobs = b.jobs,
+                           .keepgoing = b.keepgoing };
+    strlcpy(req.version, VERSION, sizeof(req.version));
+    strlcpy(req.cwd, b.cwd, PATH_MAX);
+    strlcpy(req.bakefile, b.bakefile, PATH_MAX);
+    int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    char ctl[CMSG_SPACE(sizeof(fds))] = {};
+    struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+    struct msghdr msg = { .msg_iov = &iov,
+                          .msg_iovlen = 1,
+                          .msg_control = ctl,
+                          .msg_controllen = sizeof(ctl) };
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    fflush(stdout);
+    // a server that just died must not take us with it
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+    ssize_t n = sendmsg(fd, &msg, 0);
+    int32_t rep = SERVER_REFUSED;
+    bool ok = n > 0 &&
+              write_all(fd, (char *)&req + n, sizeof(req) - n) &&
+              read_all(fd, &rep, sizeof(rep));
+    signal(SIGPIPE, sigpipe);
+    if(!ok || rep != SERVER_ACCEPTED) {
+        close(fd);
+        return -1;
+    }
+    ok = read_all(fd, &rep, sizeof(rep));
+    close(fd);
+    if(!ok) {
+        report_error("the bake server exited during the build");
+    }
+    return rep;
+}
+
+void server_unlink()
+{
+    if(getpid() == b.server.pid) {
+        unlink(b.server.path);
+    }
+}
+
+void server_listen()
+{
+    struct sockaddr_un addr;
+    if(!server_addr(&addr)) {
+        report_error("the path of the server socket '%s' is too long",
+                     addr.sun_path);
+    }
+    strlcpy(b.server.path, addr.sun_path, sizeof(b.server.path));
+    b.server.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(b.server.fd < 0) {
+        report_error("socket() failed: %s", strerror(errno));
+    }
+    fcntl(b.server.fd, F_SETFD, FD_CLOEXEC);
+    // only we may run builds through it
+    mode_t mask = umask(077);
+    int r = bind(b.server.fd, (struct sockaddr *)&addr, sizeof(addr));
+    if(r < 0 && errno == EADDRINUSE) {
+        int c = server_connect();
+        if(c >= 0) {
+            close(c);
+            umask(mask);
+            report_error("a bake server is already running on %s",
+                         b.server.path);
+        }
+        // left behind by a server that was killed
+        unlink(b.server.path);
+        r = bind(b.server.fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    umask(mask);
+    if(r < 0 || listen(b.server.fd, 16) < 0) {
+        report_error("cannot listen on %s: %s", b.server.path, strerror(errno));
+    }
+}
+
+// forks into the background, the parent returns to the shell
+void server_detach()
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0) {
+        report_error("fork() failed: %s", strerror(errno));
+    }
+    if(pid > 0) {
+        _exit(0);
+    }
+    setsid();
+    int fd = open("/dev/null", O_RDWR);
+    dup2(fd, STDIN_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if(fd > STDERR_FILENO) {
+        close(fd);
+    }
+}
+
+// true if the bakefile is not the one the server parsed anymore
+bool server_stale()
+{
+    struct stat statbuf = {};
+    stat(b.bakefile, &statbuf);
+    return stat_mtime(&statbuf) != stat_mtime(&b.server.bakefile) ||
+           statbuf.st_size != b.server.bakefile.st_size ||
+           statbuf.st_ino != b.server.bakefile.st_ino;
+}
+
+#ifdef __linux__
+// drops the stat cache entries of everything inotify reported since the
+// last sync, they are stat()'d again the next time they are looked at
+void stat_sync()
+{
+    bake_strset_t *changed = &b.watch.pending;
+    bool all = b.watch.overflow;
+    if(!all && !changed->n) {
+        return;
+    }
+    for(int i = 0; i < statcache.cap; i++) {
+        bake_stat_t *e = &statcache.ent[i];
+        if(!e->path || e->stale) {
+            continue;
+        }
+        const char *slash = strrchr(e->path, '/');
+        char k[PATH_MAX];
+        char dk[32];
+        snprintf(k, PATH_MAX, "%d/%s", e->wd, slash ? slash + 1 : e->path);
+        snprintf(dk, sizeof(dk), "%d/", e->wd);
+        // a dir changes with everything in it
+        if(all || e->isdir || strset_has(changed, k) ||
+           strset_has(changed, dk)) {
+            e->stale = true;
+            e->wd = 0;
+        }
+    }
+    strset_clear(changed);
+    b.watch.overflow = false;
+}
+
+void server_sync()
+{
+    watch_read();
+    stat_sync();
+}
+
+// watches the dir of every path the build stat()'d. a path whose dir was
+// not watched yet may have changed in between, it is stat()'d again next
+// time
+void server_track()
+{
+    for(int i = 0; i < statcache.cap; i++) {
+        bake_stat_t *e = &statcache.ent[i];
+        if(!e->path || e->stale) {
+            continue;
+        }
+        // files created in it only show up as events of the dir itself
+        if(e->isdir && watch_dir(e->path, false) < 0) {
+            e->stale = true;
+            continue;
+        }
+        if(e->wd) {
+            continue;
+        }
+        char k[PATH_MAX];
+        e->wd = watch_key(e->path, k);
+        if(e->wd < 0) {
+            e->wd = 0;
+        }
+        e->stale = true;
+    }
+}
+
+// waits for the next client, keeps the stat cache in sync meanwhile
+void server_wait()
+{
+    for(;;) {
+        struct pollfd fds[3] = { { .fd = b.server.fd, .events = POLLIN },
+                                 { .fd = b.watch.fd, .events = POLLIN },
+                                 { .fd = b.sigfd, .events = POLLIN } };
+        if(poll(fds, 3, -1) <= 0) {
+            continue;
+        }
+        if(fds[1].revents & POLLIN) {
+            server_sync();
+        }
+        if(fds[2].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if(read(b.sigfd, &si, sizeof(si)) == sizeof(si)) {
+                exit(0);
+            }
+        }
+        if(fds[0].revents & POLLIN) {
+            return;
+        }
+    }
+}
+#else
+void server_sync()
+{
+}
+
+// without inotify nothing tells the server what changed, every build
+// stat()s everything again
+void server_track()
+{
+    statcache_cleanup();
+}
+
+void server_wait()
+{
+}
+#endif
+
+// waits for the running jobs, a client that hangs up cancels the build
+void server_poll()
+{
+    struct pollfd fds[2] = { { .fd = b.server.conn, .events = POLLIN },
+                             { .fd = b.sigfd ? b.sigfd : -1,
+                               .events = POLLIN } };
+    pool_poll(fds, 2, -1);
+    // a client sends nothing after its request, so it is gone
+    if(fds[0].revents & (POLLIN | POLLHUP)) {
+        b.server.cancel = true;
+    }
+#ifdef __linux__
+    if(fds[1].revents & POLLIN) {
+        struct signalfd_siginfo si;
+        while(read(b.sigfd, &si, sizeof(si)) == sizeof(si)) {
+            b.server.quit = true;
+            b.server.cancel = true;
+        }
     }
-    for(int j = 0; j < i; j++) {
-        if(needs_rebuild(outs[i], ins[i])) {
-            neededo[ind] = strdup(outs[i]);
-            neededc[ind] = strdup(ins[i]);
-            ind++;
+#endif
+}
+
+void server_serve(int c)
+{
+    bake_request_t req;
+    int fds[2] = { -1, -1 };
+    char ctl[CMSG_SPACE(sizeof(fds))] = {};
+    struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+    struct msghdr msg = { .msg_iov = &iov,
+                          .msg_iovlen = 1,
+                          .msg_control = ctl,
+                          .msg_controllen = sizeof(ctl) };
+    ssize_t n = recvmsg(c, &msg, 0);
+    if(n <= 0) {
+        return;
+    }
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if(cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+       cm->cmsg_len == CMSG_LEN(sizeof(fds))) {
+        memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    }
+    bool ok = fds[0] >= 0 && read_all(c, (char *)&req + n, sizeof(req) - n) &&
+              req.magic == SERVER_MAGIC;
+    char ours[PATH_MAX];
+    char theirs[PATH_MAX];
+    if(ok) {
+        req.version[sizeof(req.version) - 1] = 0;
+        req.cwd[PATH_MAX - 1] = 0;
+        req.bakefile[PATH_MAX - 1] = 0;
+        // paths in the bakefile are relative to the dir bake runs in
+        ok = strcmp(req.version, VERSION) == 0 && strcmp(req.cwd, b.cwd) == 0 &&
+             realpath(req.bakefile, theirs) && realpath(b.bakefile, ours) &&
+             strcmp(theirs, ours) == 0;
+    }
+    int32_t rep = ok ? SERVER_ACCEPTED : SERVER_REFUSED;
+    if(!write_all(c, &rep, sizeof(rep)) || !ok || req.op == SERVER_STOP) {
+        if(ok) {
+            rep = 0;
+            write_all(c, &rep, sizeof(rep));
+            b.server.quit = true;
+        }
+        if(fds[0] >= 0) {
+            close(fds[0]);
+            close(fds[1]);
         }
+        return;
     }
-    for(int j = 0; j < ind; j++) {
-        compile(p, neededc[j], neededo[j], j + 1, ind);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    // the client may be a terminal or a log
+    render_init();
+    tab();
+    styl_set_bold(true);
+    styl_set_color(3);
+    printf("Using ");
+    styl_reset();
+    printf("Bakefile: %s (server %d)\n", b.bakefile, (int)getpid());
+    if(b.server.broken) {
+        fputs(b.server.broken, stdout);
+        status(1, "Keeping", "the bakefile the server parsed last");
     }
-    for(int j = 0; j < ind; j++) {
-        free(neededo[j]);
-        free(neededc[j]);
+    b.jobs = req.jobs > 0 ? req.jobs : b.server.jobs;
+    pool_fit();
+    b.keepgoing = req.keepgoing || b.server.keepgoing;
+    b.server.conn = c;
+    b.server.cancel = false;
+    // the compiler may have been replaced since the last build
+    b.cache.identity = 0;
+    server_sync();
+    int r = build_projects();
+    cache_finish();
+    // save what this build learned, bake without the server sees it too
+    db_close();
+    db_open();
+    server_track();
+    fflush(stdout);
+    fflush(stderr);
+    dup2(b.server.devnull, STDOUT_FILENO);
+    dup2(b.server.devnull, STDERR_FILENO);
+    rep = r == BUILD_OK ? 0 : 1;
+    write_all(c, &rep, sizeof(rep));
+}
+
+void parse_bakefile();
+void config_resolve();
+
+// parses the changed bakefile in a child, the restarted server would die
+// on one that doesn't parse. returns what bake printed about it, NULL if
+// it is fine
+char *server_check()
+{
+    int fds[2];
+    if(pipe(fds) < 0) {
+        return NULL;
     }
-    free(neededo);
-    free(neededc);
-    for(int i = 0; i < bn; i++) {
-        free(outs[i]);
-        free(ins[i]);
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
     }
-    free(outs);
-    free(ins);
-    if(ind)
-        printf("\n");
-    if(p.isexec)
-        linkapp(p, list, bn);
-    if(p.islib)
-        linklib(p, list, bn);
-    compilecleanup(p);
-    free(list);
+    if(pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        render_init();
+        // from a clean slate, like a run without a plan
+        plan_close();
+        memset(&b.cfg, 0, sizeof(b.cfg));
+        parse_bakefile();
+        config_resolve();
+        fflush(stdout);
+        _exit(0);
+    }
+    close(fds[1]);
+    bake_capture_t out = { .fd = fds[0] };
+    capture_read(&out);
+    int stat;
+    while(waitpid(pid, &stat, 0) < 0 && errno == EINTR) {
+    }
+    if(WIFEXITED(stat) && WEXITSTATUS(stat) == 0) {
+        free(out.buf);
+        return NULL;
+    }
+    capture_add(&out, "", 1);
+    // the server goes on, unlike bake after report_error()
+    char *tail = strstr(out.buf, "Error occured, exiting program\n");
+    if(tail) {
+        *tail = 0;
+    }
+    return out.buf;
 }
 
-void build_ext(bake_ext_t e)
+// keeps the parsed bakefile, the stat cache and the build database in
+// memory and builds whenever a client asks, until bake --stop-server
+[[noreturn]] void server()
 {
-    char bp[PATH_MAX] = { 0 };
-    strlcpy(bp, "", PATH_MAX);
-    strlcat(bp, e.loc, PATH_MAX);
-    strlcat(bp, "/", PATH_MAX);
-    strlcat(bp, e.chdir, PATH_MAX);
-    chdir_h(bp);
-    int argc = 0;
-    char **argv = malloc(1);
-    int buildcmdcount = toml_array_nelem(e.buildcmd);
-    if(buildcmdcount == 0) {
-        // ????????
-        extcleanup(e);
-        return;
+    // clients may hang up at any time
+    signal(SIGPIPE, SIG_IGN);
+    // a restarted server has its banner buffered for /dev/null still
+    fflush(stdout);
+    const char *inherited = getenv("BAKE_SERVER_FD");
+    if(inherited) {
+        // restarted for a changed bakefile, clients kept waiting on the
+        // socket meanwhile
+        struct sockaddr_un addr;
+        server_addr(&addr);
+        strlcpy(b.server.path, addr.sun_path, sizeof(b.server.path));
+        b.server.fd = atoi(inherited);
+        fcntl(b.server.fd, F_SETFD, FD_CLOEXEC);
+        unsetenv("BAKE_SERVER_FD");
+    } else {
+        server_listen();
+        status(3, "Serving", b.server.path);
+        server_detach();
+        b.server.pid = getpid();
+        atexit(server_unlink);
     }
-    for(int i = 0; i < buildcmdcount; i++) {
-        add_argv(argc, &argv, toml_string_at(e.buildcmd, i).u.s);
+    b.server.devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    // clients get their lines as they are printed
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    stat(b.bakefile, &b.server.bakefile);
+    b.server.jobs = b.jobs;
+    b.server.keepgoing = b.keepgoing;
+#ifdef __linux__
+    inotify_open();
+    signals_init();
+#endif
+    b.server.on = true;
+    for(;;) {
+        server_wait();
+        if(server_stale()) {
+            // before the check, an editor may still be writing it
+            struct stat now = {};
+            stat(b.bakefile, &now);
+            free(b.server.broken);
+            b.server.broken = server_check();
+            if(b.server.broken) {
+                // checked again once it changes
+                b.server.bakefile = now;
+            } else {
+                char fd[16];
+                snprintf(fd, sizeof(fd), "%d", b.server.fd);
+                fcntl(b.server.fd, F_SETFD, 0);
+                setenv("BAKE_SERVER_FD", fd, 1);
+                restart();
+            }
+        }
+        int c = accept(b.server.fd, NULL, NULL);
+        if(c < 0) {
+            continue;
+        }
+        fcntl(c, F_SETFD, FD_CLOEXEC);
+        server_serve(c);
+        close(c);
+        if(b.server.quit) {
+            exit(0);
+        }
     }
-    exec(argc, argv);
-    extcleanup(e);
-    return;
 }
 
 bake_ext_t parse_extproj_toml(toml_table_t *root, char *target,
@@ -639,20 +6067,41 @@ bake_ext_t parse_extproj_toml(toml_table_t *root, char *target,
 {
     bake_ext_t ret;
     toml_table_t *exttbl = toml_table_in(root, target);
-    ret.scrname = strdup(target_scrname);
-    ret.idname = strdup(target);
-    toml_datum_t chdir = toml_string_in(exttbl, "chdir");
-    toml_datum_t loc = toml_string_in(exttbl, "loc");
-    toml_array_t *buildcmd = toml_array_in(exttbl, "buildcmd");
-    ret.chdir = chdir.u.s;
-    ret.loc = loc.u.s;
-    ret.buildcmd = buildcmd;
+    if(!exttbl) {
+        report_error("cannot find [ext.%s]", target);
+    }
+    ret.scrname = plan_copy(target_scrname);
+    ret.idname = plan_copy(target);
+    ret.chdir = plan_take(toml_string_in(exttbl, "chdir"));
+    ret.loc = plan_take(toml_string_in(exttbl, "loc"));
+    ret.buildcmd = plan_list(toml_array_in(exttbl, "buildcmd"));
+    ret.fingerprint = EXT_FP_NONE;
+    toml_array_t *outputs = toml_array_in(exttbl, "outputs");
+    ret.outputs = plan_list(outputs);
+    ret.built = false;
+    toml_datum_t fp = toml_string_in(exttbl, "fingerprint");
+    if(fp.ok) {
+        if(strcmp(fp.u.s, "tree") == 0) {
+            ret.fingerprint = EXT_FP_TREE;
+        } else if(strcmp(fp.u.s, "outputs") == 0) {
+            if(!outputs) {
+                report_error("[ext.%s] fingerprint = \"outputs\" needs outputs",
+                             target);
+            }
+            ret.fingerprint = EXT_FP_OUTPUTS;
+        } else {
+            report_error("[ext.%s] fingerprint must be \"tree\" or \"outputs\", not '%s'",
+                         target, fp.u.s);
+        }
+        free(fp.u.s);
+    }
 
     return ret;
 }
 
+// deps gets the names in deps, the plan has indices instead
 bake_project_t parse_proj_toml(toml_table_t *projroot, char *target,
-                               char *target_scrname)
+                               char *target_scrname, bake_strv_t *deps)
 {
     toml_table_t *proj = toml_table_in(projroot, target);
     if(!proj) {
@@ -675,60 +6124,503 @@ bake_project_t parse_proj_toml(toml_table_t *projroot, char *target,
         ret.islib = true;
     }
     free(typ.u.s);
-    toml_datum_t srcs = toml_string_in(proj, "srcs");
-    toml_datum_t bin = toml_string_in(proj, "bin");
-    toml_array_t *ccflags = toml_array_in(proj, "ccflags");
-    toml_array_t *incflags = toml_array_in(proj, "incflags");
-    toml_array_t *ldflags = toml_array_in(proj, "ldflags");
-    toml_array_t *deps = toml_array_in(proj, "deps");
-    toml_datum_t binname = toml_string_in(proj, "binname");
-    ret.srcs = srcs.u.s;
-    ret.binname = binname.u.s;
-    ret.bindir = bin.u.s;
-    ret.ccflags = ccflags;
-    ret.idname = strdup(target);
-    ret.scrname = strdup(target_scrname);
-    ret.incflags = incflags;
-    ret.ldflags = ldflags;
-    ret.deps = deps;
-    ret.depcompiled = false;
-    ret.cleaned = false;
+    ret.srcs = plan_take(toml_string_in(proj, "srcs"));
+    ret.binname = plan_take(toml_string_in(proj, "binname"));
+    ret.bindir = plan_take(toml_string_in(proj, "bin"));
+    ret.ccflags = plan_list(toml_array_in(proj, "ccflags"));
+    ret.idname = plan_copy(target);
+    ret.scrname = plan_copy(target_scrname);
+    ret.incflags = plan_list(toml_array_in(proj, "incflags"));
+    ret.ldflags = plan_list(toml_array_in(proj, "ldflags"));
+    *deps = plan_list(toml_array_in(proj, "deps"));
+    ret.deps = NULL;
+    ret.ndeps = 0;
+    toml_datum_t thin = toml_bool_in(proj, "thin");
+    ret.thin = thin.ok && thin.u.b;
+    toml_datum_t unity = toml_bool_in(proj, "unity");
+    toml_datum_t unitybatch = toml_int_in(proj, "unity_batch");
+    // unity_batch alone turns it on too
+    ret.unity = unity.ok ? unity.u.b : unitybatch.ok;
+    ret.unitybatch = unitybatch.ok ? (int)unitybatch.u.i : 8;
+    if(ret.unitybatch < 1) {
+        report_error("[project.%s] unity_batch must be a positive number",
+                     target);
+    }
+    ret.unityexclude = plan_list(toml_array_in(proj, "unity_exclude"));
+    ret.pch = plan_take(toml_string_in(proj, "pch"));
+    ret.lto = LTO_OFF;
+    toml_datum_t lto = toml_string_in(proj, "lto");
+    if(lto.ok) {
+        if(strcmp(lto.u.s, "full") == 0) {
+            ret.lto = LTO_FULL;
+        } else if(strcmp(lto.u.s, "thin") == 0) {
+            ret.lto = LTO_THIN;
+        } else if(strcmp(lto.u.s, "off") != 0) {
+            report_error("[project.%s] lto must be \"off\", \"full\" or "
+                         "\"thin\", not '%s'",
+                         target, lto.u.s);
+        }
+        free(lto.u.s);
+    }
+    toml_datum_t ltojobs = toml_int_in(proj, "lto_jobs");
+    ret.ltojobs = ltojobs.ok ? (int)ltojobs.u.i : 0;
+    toml_datum_t ltosize = toml_int_in(proj, "lto_cache_size");
+    ret.ltocachesize = ltosize.ok ? ltosize.u.i : 1024;
+    toml_datum_t ltoexpire = toml_int_in(proj, "lto_cache_expire");
+    ret.ltocacheexpire = ltoexpire.ok ? (int)ltoexpire.u.i : 168;
+    if(ret.ltojobs < 0 || ret.ltocachesize < 1 || ret.ltocacheexpire < 1) {
+        report_error("[project.%s] lto_jobs, lto_cache_size and "
+                     "lto_cache_expire must be positive numbers",
+                     target);
+    }
+    ret.pgotrain = plan_take(toml_string_in(proj, "pgo_train"));
+    ret.pgogen = false;
+    if(ret.pgotrain && !ret.isexec) {
+        report_error("[project.%s] pgo_train needs type = \"exec\"", target);
+    }
     return ret;
 }
 
-int main(int argc, char *argv[])
+// a compile or link read back from the history
+typedef struct {
+    int run;
+    char kind;
+    const char *cache;
+    int64_t duration;
+    int64_t cpu;
+    int64_t maxrss;
+    const char *proj;
+    const char *out;
+} bake_histent_t;
+
+typedef struct {
+    // newest one that did the work and the newest one up to the baseline
+    bake_histent_t *last;
+    bake_histent_t *base;
+    int64_t delta;
+} bake_histtarget_t;
+
+static int histent_cmp(const void *a, const void *b_)
 {
-    styl_set_bold(true);
-    styl_set_color(1);
-    tab();
-    printf("Bake ");
-    styl_reset();
-    printf(" %s\n", VERSION);
-    if(argc > 2) {
-        report_error("excessive arguments\nhelp: %s [optional: bake file]",
-                     argv[0]);
+    const bake_histent_t *x = *(bake_histent_t *const *)a;
+    const bake_histent_t *y = *(bake_histent_t *const *)b_;
+    int c = strcmp(x->out, y->out);
+    if(c) {
+        return c;
     }
-    if(argc == 1) {
-        strlcpy(b.bakefile, "bake.toml", PATH_MAX);
+    // the file is in run order
+    return x < y ? -1 : x > y;
+}
+
+static int histtarget_slowest(const void *a, const void *b_)
+{
+    const bake_histtarget_t *x = a, *y = b_;
+    return x->last->duration < y->last->duration ? 1
+           : x->last->duration > y->last->duration ? -1
+                                                   : 0;
+}
+
+static int histtarget_movers(const void *a, const void *b_)
+{
+    const bake_histtarget_t *x = a, *y = b_;
+    int64_t dx = x->delta < 0 ? -x->delta : x->delta;
+    int64_t dy = y->delta < 0 ? -y->delta : y->delta;
+    return dx < dy ? 1 : dx > dy ? -1 : 0;
+}
+
+void stats_time(char *out, size_t len, time_t t)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(out, len, "%Y-%m-%d %H:%M", &tm);
+}
+
+// bake stats: the slowest compiles, what got slower or faster since a
+// baseline run and the compile cpu time of every project, from the
+// history the builds left behind
+int stats(int argc, char **argv)
+{
+    const char *help = "help: %s stats [-n rows] [-b baseline run] "
+                       "[optional: bake file]";
+    int rows = 10;
+    int baseline = 0;
+    bool hasbase = false;
+    int opt;
+    while((opt = getopt(argc, argv, "n:b:")) != -1) {
+        switch(opt) {
+        case 'n':
+            rows = atoi(optarg);
+            if(rows < 1) {
+                report_error("-n expects a positive number of rows, got '%s'",
+                             optarg);
+            }
+            break;
+        case 'b':
+            baseline = atoi(optarg);
+            hasbase = true;
+            break;
+        default:
+            report_error(help, b.argv[0]);
+        }
+    }
+    if(argc - optind > 1) {
+        report_error(help, b.argv[0]);
+    }
+    strlcpy(b.bakefile, optind < argc ? argv[optind] : "bake.toml", PATH_MAX);
+    char path[PATH_MAX];
+    bakefile_sibling(".bake.history", path, PATH_MAX);
+    int fd = open(path, O_RDONLY);
+    struct stat statbuf;
+    if(fd < 0 || fstat(fd, &statbuf) != 0) {
+        report_error("no build history in '%s', it is written by every build",
+                     path);
+    }
+    char *buf = malloc(statbuf.st_size + 1);
+    if(!read_all(fd, buf, statbuf.st_size)) {
+        report_error("cannot read '%s': %s", path, strerror(errno));
+    }
+    close(fd);
+    buf[statbuf.st_size] = 0;
+
+    bake_histent_t *ents = NULL;
+    int n = 0, cap = 0;
+    int runs = 0;
+    time_t *runtime = NULL;
+    for(char *line = buf, *next; *line; line = next) {
+        next = strchr(line, '\n');
+        if(!next) {
+            // cut off by a bake that did not finish writing
+            break;
+        }
+        *next++ = 0;
+        // the output path is last, it may have tabs in it
+        char *f[7];
+        int nf = 0;
+        for(char *c = line; c && nf < 7;) {
+            f[nf++] = c;
+            c = nf < 7 ? strchr(c, '\t') : NULL;
+            if(c) {
+                *c++ = 0;
+            }
+        }
+        if(nf == 3 && strcmp(f[0], "run") == 0) {
+            runtime = realloc(runtime, sizeof(time_t) * (runs + 1));
+            runtime[runs++] = (time_t)atoll(f[1]);
+            continue;
+        }
+        if(nf != 7 || !runs) {
+            continue;
+        }
+        if(n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            ents = realloc(ents, sizeof(bake_histent_t) * cap);
+        }
+        ents[n++] = (bake_histent_t){ .run = runs,
+                                      .kind = f[0][0],
+                                      .cache = f[1],
+                                      .duration = atoll(f[2]),
+                                      .cpu = atoll(f[3]),
+                                      .maxrss = atoll(f[4]),
+                                      .proj = f[5],
+                                      .out = f[6] };
+    }
+    if(!runs) {
+        report_error("the build history in '%s' is empty", path);
+    }
+    // runs count from 1, a baseline of 0 or less counts back from the last
+    if(!hasbase) {
+        baseline = 1;
+    } else if(baseline <= 0) {
+        baseline += runs;
+    }
+    if(baseline < 1 || baseline > runs) {
+        report_error("there is no run %d, the history has runs 1 to %d",
+                     baseline, runs);
+    }
+
+    bake_histent_t **sorted = malloc(sizeof(bake_histent_t *) * (n + 1));
+    for(int i = 0; i < n; i++) {
+        sorted[i] = &ents[i];
+    }
+    qsort(sorted, n, sizeof(bake_histent_t *), histent_cmp);
+    bake_histtarget_t *targets = malloc(sizeof(bake_histtarget_t) * (n + 1));
+    int nt = 0;
+    for(int i = 0; i < n;) {
+        int k = i;
+        bake_histtarget_t t = {};
+        for(; k < n && strcmp(sorted[k]->out, sorted[i]->out) == 0; k++) {
+            // a cache hit says nothing about how long it takes to compile
+            if(strcmp(sorted[k]->cache, "hit") == 0) {
+                continue;
+            }
+            t.last = sorted[k];
+            if(sorted[k]->run <= baseline) {
+                t.base = sorted[k];
+            }
+        }
+        i = k;
+        // outputs that are gone are not built anymore
+        if(t.last && access(t.last->out, F_OK) == 0) {
+            t.delta = t.base ? t.last->duration - t.base->duration : 0;
+            targets[nt++] = t;
+        }
+    }
+
+    char from[32], to[32], sum[128];
+    stats_time(from, sizeof(from), runtime[0]);
+    stats_time(to, sizeof(to), runtime[runs - 1]);
+    snprintf(sum, sizeof(sum), "%d run(s) from %s to %s", runs, from, to);
+    status(3, "History", sum);
+
+    qsort(targets, nt, sizeof(bake_histtarget_t), histtarget_slowest);
+    status(3, "Slowest", "compiles");
+    for(int i = 0, k = 0; i < nt && k < rows; i++) {
+        bake_histent_t *e = targets[i].last;
+        if(e->kind != 'c') {
+            continue;
+        }
+        tab();
+        tab();
+        printf("%8.3fs  cpu %8.3fs  %7.1f MiB  %-5s  run %-4d %s\n",
+               e->duration / 1e9, e->cpu / 1e9, e->maxrss / 1024.0, e->cache,
+               e->run, e->out);
+        k++;
+    }
+
+    stats_time(from, sizeof(from), runtime[baseline - 1]);
+    snprintf(sum, sizeof(sum), "since run %d (%s)", baseline, from);
+    status(3, "Movers", sum);
+    qsort(targets, nt, sizeof(bake_histtarget_t), histtarget_movers);
+    int moved = 0;
+    for(int i = 0; i < nt && moved < rows; i++) {
+        bake_histtarget_t *t = &targets[i];
+        if(!t->base || t->last->run <= baseline || !t->delta) {
+            continue;
+        }
+        tab();
+        tab();
+        printf("%+8.3fs  %8.3fs -> %8.3fs  %+6.0f%%  %-7s %s\n", t->delta / 1e9,
+               t->base->duration / 1e9, t->last->duration / 1e9,
+               t->base->duration ? 100.0 * t->delta / t->base->duration : 0.0,
+               t->last->kind == 'l' ? "link" : "compile", t->last->out);
+        moved++;
+    }
+    if(!moved) {
+        tab();
+        tab();
+        printf("nothing was built again since run %d\n", baseline);
+    }
+
+    // what compiling all of a project costs, from the last compile of
+    // every object it has now
+    status(3, "Projects", "compile cpu time");
+    int np = 0;
+    const char **projs = malloc(sizeof(char *) * (nt + 1));
+    int64_t *cpu = malloc(sizeof(int64_t) * (nt + 1));
+    int64_t *link = malloc(sizeof(int64_t) * (nt + 1));
+    int *objs = malloc(sizeof(int) * (nt + 1));
+    for(int i = 0; i < nt; i++) {
+        bake_histent_t *e = targets[i].last;
+        int k = 0;
+        while(k < np && strcmp(projs[k], e->proj) != 0) {
+            k++;
+        }
+        if(k == np) {
+            projs[np] = e->proj;
+            cpu[np] = link[np] = 0;
+            objs[np++] = 0;
+        }
+        if(e->kind == 'c') {
+            cpu[k] += e->cpu;
+            objs[k]++;
+        } else {
+            link[k] += e->duration;
+        }
+    }
+    for(int i = 0; i < np; i++) {
+        tab();
+        tab();
+        printf("%9.3fs  %5d object(s)  link %8.3fs  %s\n", cpu[i] / 1e9,
+               objs[i], link[i] / 1e9, projs[i]);
+    }
+    free(projs);
+    free(cpu);
+    free(link);
+    free(objs);
+    free(targets);
+    free(sorted);
+    free(ents);
+    free(runtime);
+    free(buf);
+    return 0;
+}
+
+// runs argv and waits for it, returns its exit status or -1
+int run_wait(char **argv)
+{
+    pid_t pid;
+    if(posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        return -1;
+    }
+    int stat;
+    while(waitpid(pid, &stat, 0) < 0) {
+        if(errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(stat) ? WEXITSTATUS(stat) : -1;
+}
+
+// removes what an earlier training left in dir
+void pgo_clean(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while(d && (e = readdir(d))) {
+        const char *ext = strrchr(e->d_name, '.');
+        if(ext && (strcmp(ext, ".profraw") == 0 || strcmp(ext, ".gcda") == 0)) {
+            char path[PATH_MAX];
+            snprintf(path, PATH_MAX, "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+    }
+    if(d) {
+        closedir(d);
+    }
+}
+
+// turns what the training wrote into raw into the profile of project pi.
+// clang: llvm-profdata merges the .profraw files, gcc: the .gcda files are
+// renamed after the objects of the optimized build
+void pgo_merge(int pi, const char *pgobin, const char *raw)
+{
+    bake_project_t p = b.proj[pi];
+    char prof[PATH_MAX];
+    pgo_profile(p, prof);
+    bake_args_t args = {};
+    char gcdadir[PATH_MAX], from[PATH_MAX], to[PATH_MAX];
+    if(cc_clang()) {
+        char tool[PATH_MAX];
+        if(!find_program("llvm-profdata", tool)) {
+            report_error("bake pgo needs llvm-profdata in PATH");
+        }
+        args_add(&args, tool);
+        args_add(&args, "merge");
+        args_add(&args, "-o");
+        args_add(&args, prof);
     } else {
-        strlcpy(b.bakefile, argv[1], PATH_MAX);
-        if(access(b.bakefile, F_OK) != 0) {
-            report_error("bakefile '%s' does not exist", b.bakefile);
+        mkdir_p(prof);
+        pgo_clean(prof);
+        // ./<pgobin>/x.o was compiled, ./<bindir>/x.o looks for its profile
+        snprintf(from, PATH_MAX, "%s/./%s/", b.cwd, pgobin);
+        pgo_mangle(from, gcdadir);
+        strlcpy(from, gcdadir, PATH_MAX);
+        snprintf(to, PATH_MAX, "%s/./%s/", b.cwd, p.bindir);
+        pgo_mangle(to, gcdadir);
+    }
+    int n = 0;
+    DIR *d = opendir(raw);
+    struct dirent *e;
+    while(d && (e = readdir(d))) {
+        char path[PATH_MAX], dest[PATH_MAX];
+        snprintf(path, PATH_MAX, "%s/%s", raw, e->d_name);
+        const char *ext = strrchr(e->d_name, '.');
+        if(!ext) {
+            continue;
+        }
+        if(cc_clang() && strcmp(ext, ".profraw") == 0) {
+            args_add(&args, path);
+            n++;
+        } else if(!cc_clang() && strcmp(ext, ".gcda") == 0 &&
+                  strncmp(e->d_name, from, strlen(from)) == 0) {
+            snprintf(dest, PATH_MAX, "%s/%s%s", prof, gcdadir,
+                     e->d_name + strlen(from));
+            n += rename(path, dest) == 0;
         }
     }
-    getcwd(b.cwd, PATH_MAX);
+    if(d) {
+        closedir(d);
+    }
+    if(!n) {
+        report_error("the training of %s did not write a profile to %s",
+                     p.scrname, raw);
+    }
+    if(args.argv && run_wait(args.argv) != 0) {
+        report_error("llvm-profdata could not merge the profiles in %s", raw);
+    }
+    args_free(&args);
+    char sum[PATH_MAX + 64];
+    snprintf(sum, sizeof(sum), "%s (%d file(s))", prof, n);
+    status(3, "Profiled", sum);
+}
+
+// bake pgo: the exec projects with a pgo_train command are built
+// instrumented into <bin>/pgo, the command runs, what it recorded becomes
+// the profile and everything is built again with it
+void pgo_run()
+{
+    char **orig = calloc(b.projs, sizeof(char *));
+    int n = 0;
+    for(int i = 0; i < b.projs; i++) {
+        bake_project_t *p = &b.proj[i];
+        if(!p->pgotrain) {
+            continue;
+        }
+        orig[i] = p->bindir;
+        p->bindir = malloc(PATH_MAX);
+        snprintf(p->bindir, PATH_MAX, "%s/pgo", orig[i]);
+        p->pgogen = true;
+        char raw[PATH_MAX];
+        snprintf(raw, PATH_MAX, "%s/raw", p->bindir);
+        mkdir_p(raw);
+        // counters of an older binary don't fit the new one
+        pgo_clean(raw);
+        n++;
+    }
+    if(!n) {
+        report_error("no [project.*] has a pgo_train command");
+    }
+    status(3, "Instrumenting", b.bakefile);
+    build_projects();
+    for(int i = 0; i < b.projs; i++) {
+        bake_project_t *p = &b.proj[i];
+        if(!orig[i]) {
+            continue;
+        }
+        char bin[PATH_MAX], raw[PATH_MAX], rawfile[PATH_MAX + 32];
+        snprintf(bin, PATH_MAX, "%s/%s", p->bindir, p->binname);
+        snprintf(raw, PATH_MAX, "%s/%s/raw", b.cwd, p->bindir);
+        // one file per process and binary, a training may start several
+        snprintf(rawfile, sizeof(rawfile), "%s/%%p-%%m.profraw", raw);
+        setenv("LLVM_PROFILE_FILE", rawfile, 1);
+        setenv("BAKE_PGO_BIN", bin, 1);
+        status(3, "Training", p->pgotrain);
+        char *argv[] = { "/bin/sh", "-c", p->pgotrain, NULL };
+        int r = run_wait(argv);
+        if(r != 0) {
+            report_error("pgo_train of %s failed (exit status %d)", p->scrname,
+                         r);
+        }
+        char *pgobin = p->bindir;
+        p->bindir = orig[i];
+        p->pgogen = false;
+        pgo_merge(i, pgobin, raw);
+        free(pgobin);
+    }
+    free(orig);
+    status(3, "Optimizing", b.bakefile);
+    build_projects();
+}
+
+// reads the bakefile into b, the strings stay in the plan blocks until
+// plan_save()
+void parse_bakefile()
+{
     b.cfg.cfg = (void *)1;
     b.toml = (void *)1;
     b.projlist = (void *)1;
     b.extroot = (void *)1;
     b.proj = malloc(1);
-    tab();
-    styl_set_bold(true);
-    styl_set_color(3);
-    printf("Using ");
-    styl_reset();
-    printf("Bakefile: %s\n", b.bakefile);
-
     FILE *f = fopen(b.bakefile, "r");
     if(!f) {
         report_error(
@@ -747,9 +6639,56 @@ int main(int argc, char *argv[])
     if(!cfg_cc.ok || !cfg_as.ok || !cfg_ld.ok) {
         report_error("cannot read configuration");
     }
-    b.cfg.cc = cfg_cc.u.s;
-    b.cfg.as = cfg_as.u.s;
-    b.cfg.ld = cfg_ld.u.s;
+    b.cfg.cc = plan_take(cfg_cc);
+    b.cfg.as = plan_take(cfg_as);
+    b.cfg.ld = plan_take(cfg_ld);
+    toml_datum_t cfg_rebuild = toml_string_in(b.cfg.cfg, "rebuild");
+    if(cfg_rebuild.ok) {
+        if(strcmp(cfg_rebuild.u.s, "hash") == 0) {
+            b.cfg.hashrebuild = true;
+        } else if(strcmp(cfg_rebuild.u.s, "mtime") != 0) {
+            report_error("[config] rebuild must be \"mtime\" or \"hash\", not '%s'",
+                         cfg_rebuild.u.s);
+        }
+        free(cfg_rebuild.u.s);
+    }
+    toml_datum_t cfg_jobs = toml_int_in(b.cfg.cfg, "jobs");
+    if(cfg_jobs.ok) {
+        if(cfg_jobs.u.i < 1) {
+            report_error("[config] jobs must be a positive number");
+        }
+        b.cfg.jobs = (int)cfg_jobs.u.i;
+    }
+    toml_datum_t cfg_cache = toml_bool_in(b.cfg.cfg, "cache");
+    b.cfg.cache = cfg_cache.ok && cfg_cache.u.b;
+    if(b.cfg.cache) {
+        b.cfg.cachepath = plan_take(toml_string_in(b.cfg.cfg, "cache_dir"));
+        // in MiB
+        toml_datum_t cfg_cachesize = toml_int_in(b.cfg.cfg, "cache_size");
+        b.cfg.cachesize = (cfg_cachesize.ok ? cfg_cachesize.u.i : 5120) << 20;
+        toml_datum_t cfg_compress = toml_bool_in(b.cfg.cfg, "cache_compress");
+        b.cfg.cachecompress = cfg_compress.ok && cfg_compress.u.b;
+    }
+    toml_datum_t cfg_batch = toml_int_in(b.cfg.cfg, "batch");
+    if(cfg_batch.ok) {
+        if(cfg_batch.u.i < 0) {
+            report_error("[config] batch must not be negative");
+        }
+        b.cfg.batch = (int)cfg_batch.u.i;
+    }
+    b.cfg.linkerset = plan_take(toml_string_in(b.cfg.cfg, "linker"));
+    toml_datum_t cfg_ldthreads = toml_int_in(b.cfg.cfg, "link_threads");
+    if(cfg_ldthreads.ok) {
+        if(cfg_ldthreads.u.i < 1) {
+            report_error("[config] link_threads must be a positive number");
+        }
+        b.cfg.linkthreads = (int)cfg_ldthreads.u.i;
+    }
+    toml_datum_t cfg_split = toml_bool_in(b.cfg.cfg, "split_dwarf");
+    b.cfg.splitdwarf = cfg_split.ok && cfg_split.u.b;
+    toml_datum_t cfg_gdbindex = toml_bool_in(b.cfg.cfg, "gdb_index");
+    b.cfg.gdbindex = cfg_gdbindex.ok && cfg_gdbindex.u.b;
+    b.cfg.workers = plan_list(toml_array_in(b.cfg.cfg, "workers"));
     /*
     printf("compilation configuration loaded,\n");
     printf("\tc compiler: %s\n", b.cfg.cc);
@@ -769,6 +6708,7 @@ int main(int argc, char *argv[])
     }
     b.extroot = toml_table_in(b.toml, "ext");
     handlerr();
+    bake_strv_t *deps = NULL;
     for(int i = 0;; i++) {
         toml_array_t *projprop = toml_array_at(projarr, i);
         if(!projprop) {
@@ -785,7 +6725,9 @@ int main(int argc, char *argv[])
         }
         //printf("found project %s (id: %s), adding it to project list\n",
         //       scrname.u.s, idname.u.s);
-        bake_project_t p = parse_proj_toml(b.projlist, idname.u.s, scrname.u.s);
+        deps = realloc(deps, sizeof(bake_strv_t) * (b.projs + 1));
+        bake_project_t p = parse_proj_toml(b.projlist, idname.u.s, scrname.u.s,
+                                           &deps[b.projs]);
         //printf("parsed project %s (id: %s) toml\n", scrname.u.s, idname.u.s);
         add_proj(p);
         if(strcmp(p.srcs, "") == 0) {
@@ -826,43 +6768,230 @@ int main(int argc, char *argv[])
         free(idname.u.s);
         free(scrname.u.s);
     }
-    for(int i = 0; i < b.exts; i++) {
-        tab();
-        styl_set_bold(true);
-        styl_set_color(2);
-        printf("Building external ");
-        styl_reset();
-        printf("%s\n", b.ext[i].scrname);
-        build_ext(b.ext[i]);
-        tab();
-        styl_set_bold(true);
-        styl_set_color(27);
-        printf("Finished external ");
-        styl_reset();
-        printf("%s\n", b.ext[i].scrname);
-        resetcwd();
+    // deps name projects or externals, the plan has their node indices
+    for(int i = 0; i < b.projs; i++) {
+        bake_project_t *p = &b.proj[i];
+        p->deps = calloc(deps[i].n + 1, sizeof(int));
+        for(int k = 0; k < deps[i].n; k++) {
+            int dep_indx = -1;
+            for(int j = 0; j < b.projs; j++) {
+                if(strcmp(b.proj[j].idname, deps[i].v[k]) == 0) {
+                    dep_indx = j;
+                }
+            }
+            for(int j = 0; j < b.exts && dep_indx == -1; j++) {
+                if(strcmp(b.ext[j].idname, deps[i].v[k]) == 0) {
+                    dep_indx = b.projs + j;
+                }
+            }
+            if(dep_indx == -1) {
+                report_error("dependency '%s' not found", deps[i].v[k]);
+            }
+            p->deps[p->ndeps++] = dep_indx;
+        }
+        free(deps[i].v);
+    }
+    free(deps);
+    toml_free(b.toml);
+    b.toml = NULL;
+}
+
+// what the plan leaves to the machine and the command line: -j, where the
+// cache is, the tools that are installed
+void config_resolve()
+{
+    if(!b.jobs) {
+        b.jobs = b.cfg.jobs ? b.cfg.jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if(b.jobs < 1) {
+            b.jobs = 1;
+        }
+    }
+    if(b.cfg.cache) {
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if(b.cfg.cachepath) {
+            strlcpy(b.cfg.cachedir, b.cfg.cachepath, PATH_MAX);
+        } else if(xdg && *xdg) {
+            snprintf(b.cfg.cachedir, PATH_MAX, "%s/bake", xdg);
+        } else {
+            snprintf(b.cfg.cachedir, PATH_MAX, "%s/.cache/bake",
+                     home ? home : ".");
+        }
+        mkdir_p(b.cfg.cachedir);
+        char zstd[PATH_MAX];
+        if(b.cfg.cachecompress && !find_program("zstd", zstd)) {
+            printf("warning: cache_compress needs zstd in PATH, storing objects "
+                   "uncompressed\n");
+            b.cfg.cachecompress = false;
+        }
+    }
+    if(b.cfg.linkerset) {
+        linker_pick(b.cfg.linkerset);
+    }
+    for(int i = 0; i < b.cfg.workers.n; i++) {
+        b.remote.workers = realloc(b.remote.workers,
+                                   sizeof(bake_worker_t) * (b.remote.n + 1));
+        b.remote.workers[b.remote.n++] =
+            (bake_worker_t){ .addr = b.cfg.workers.v[i] };
     }
     for(int i = 0; i < b.projs; i++) {
-        bool f = b.proj[i].depcompiled;
-        if(!f) {
-            tab();
-            styl_set_bold(true);
-            styl_set_color(2);
-            printf("Building ");
-            styl_reset();
-            printf("%s\n", b.proj[i].scrname);
+        bake_project_t *p = &b.proj[i];
+        if(p->lto == LTO_THIN && !cc_clang()) {
+            printf("warning: [project.%s] lto = \"thin\" needs clang, %s gets "
+                   "full lto\n",
+                   p->idname, b.cfg.cc);
+            p->lto = LTO_FULL;
         }
-        build_project(b.proj[i]);
-        if(!f) {
-            tab();
-            styl_set_bold(true);
-            styl_set_color(27);
-            printf("Finished ");
-            styl_reset();
-            printf("%s\n", b.proj[i].scrname);
+    }
+}
+
+// long options without a short one
+#define OPT_SERVER 256
+#define OPT_STOP_SERVER 257
+#define OPT_NO_SERVER 258
+#define OPT_TRACE 259
+
+int main(int argc, char *argv[])
+{
+    render_init();
+    styl_set_bold(true);
+    styl_set_color(1);
+    tab();
+    printf("Bake ");
+    styl_reset();
+    printf(" %s\n", VERSION);
+    b.argv = argv;
+    if(argc > 1 && strcmp(argv[1], "stats") == 0) {
+        return stats(argc - 1, argv + 1);
+    }
+    // bake pgo takes the options of a build
+    bool pgo = argc > 1 && strcmp(argv[1], "pgo") == 0;
+    optind = pgo ? 2 : 1;
+    static struct option longopts[] = {
+        { "watch", no_argument, NULL, 'w' },
+        { "server", no_argument, NULL, OPT_SERVER },
+        { "stop-server", no_argument, NULL, OPT_STOP_SERVER },
+        { "no-server", no_argument, NULL, OPT_NO_SERVER },
+        { "trace", required_argument, NULL, OPT_TRACE },
+        { NULL, 0, NULL, 0 }
+    };
+    bool serve = false;
+    bool stopserver = false;
+    bool noserver = false;
+    int opt;
+    while((opt = getopt_long(argc, argv, "j:kw", longopts, NULL)) != -1) {
+        switch(opt) {
+        case 'j':
+            b.jobs = atoi(optarg);
+            if(b.jobs < 1) {
+                report_error("-j expects a positive number of jobs, got '%s'",
+                             optarg);
+            }
+            break;
+        case 'k':
+            b.keepgoing = true;
+            break;
+        case 'w':
+            b.watch.on = true;
+            break;
+        case OPT_SERVER:
+            serve = true;
+            break;
+        case OPT_STOP_SERVER:
+            stopserver = true;
+            break;
+        case OPT_NO_SERVER:
+            noserver = true;
+            break;
+        case OPT_TRACE:
+            b.trace.on = true;
+            b.trace.origin = now_ns();
+            strlcpy(b.trace.path, optarg, PATH_MAX);
+            break;
+        default:
+            report_error("unknown option\nhelp: %s [-j jobs] [-k] [-w|--watch] "
+                         "[--server|--stop-server|--no-server] [--trace file] "
+                         "[optional: bake file]",
+                         argv[0]);
+        }
+    }
+    if(argc - optind > 1) {
+        report_error("excessive arguments\nhelp: %s [-j jobs] [-k] [-w|--watch] "
+                     "[--server|--stop-server|--no-server] [--trace file] "
+                     "[optional: bake file]",
+                     argv[0]);
+    }
+    if(serve && b.watch.on) {
+        report_error("--server and --watch cannot be combined");
+    }
+    if(pgo && (serve || b.watch.on)) {
+        report_error("bake pgo cannot be combined with --server or --watch");
+    }
+    if(optind == argc) {
+        strlcpy(b.bakefile, "bake.toml", PATH_MAX);
+    } else {
+        strlcpy(b.bakefile, argv[optind], PATH_MAX);
+        if(access(b.bakefile, F_OK) != 0) {
+            report_error("bakefile '%s' does not exist", b.bakefile);
         }
     }
+    getcwd(b.cwd, PATH_MAX);
+    if(getenv("BAKE_SERVER_FD")) {
+        // a restarted server, if the bakefile doesn't parse anymore the
+        // socket must not outlive it
+        struct sockaddr_un addr;
+        server_addr(&addr);
+        strlcpy(b.server.path, addr.sun_path, sizeof(b.server.path));
+        b.server.pid = getpid();
+        atexit(server_unlink);
+    }
+    if(stopserver) {
+        if(server_request(SERVER_STOP) < 0) {
+            report_error("no bake server is running for %s", b.bakefile);
+        }
+        status(3, "Stopped", "bake server");
+        return 0;
+    }
+    if(!serve && !b.watch.on && !noserver && !b.trace.on && !pgo) {
+        // a running server already has everything parsed
+        int r = server_request(SERVER_BUILD);
+        if(r >= 0) {
+            return r;
+        }
+    }
+    tab();
+    styl_set_bold(true);
+    styl_set_color(3);
+    printf("Using ");
+    styl_reset();
+    printf("Bakefile: %s\n", b.bakefile);
 
+    int64_t parsestart = now_ns();
+    uint64_t key = plan_key();
+    bool planned = key && plan_open(key);
+    if(!planned) {
+        parse_bakefile();
+        plan_save(key);
+    }
+    trace_span("bake", planned ? "load plan" : "parse bakefile", parsestart, 0,
+               -1);
+    config_resolve();
+    pool_init();
+    db_open();
+    atexit(db_close);
+    if(b.watch.on) {
+        // watch_init() turns it on again once it is set up
+        b.watch.on = false;
+        watch();
+    } else if(serve) {
+        server();
+    } else if(pgo) {
+        pgo_run();
+        cache_finish();
+    } else {
+        build_projects();
+        cache_finish();
+    }
     cleanup();
     return 0;
 }
@@ -0,0 +1,552 @@
+// compiles preprocessed sources for bake on other cores or machines.
+//
+//   bake-worker -l <addr> [-c cc] [-j slots]
+//       listens on addr (unix:<path> or <host>:<port>) and compiles what
+//       bake sends it with cc, one process per connection
+//   bake-worker send <addr> <identity> <ifile> <object> [flags...]
+//       what bake runs for a remote compile: ships ifile to the worker at
+//       addr and writes the object it gets back
+//
+// a worker greets every connection with its compiler identity (the first
+// line of cc --version and cc -dumpmachine), send gives up when it is not
+// the one bake compiles with. send exits with SEND_UNAVAILABLE when it
+// could not get the job done by the worker, bake compiles it locally then
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define PROTO_VERSION 1
+// EX_TEMPFAIL
+#define SEND_UNAVAILABLE 75
+#define CONNECT_TIMEOUT_MS 2000
+
+void die(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "bake-worker: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+bool read_all(int fd, void *buf, size_t len)
+{
+    for(size_t done = 0; done < len;) {
+        ssize_t r = read(fd, (char *)buf + done, len - done);
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            return false;
+        }
+        done += r;
+    }
+    return true;
+}
+
+bool write_all(int fd, const void *buf, size_t len)
+{
+    for(size_t done = 0; done < len;) {
+        ssize_t w = write(fd, (const char *)buf + done, len - done);
+        if(w < 0 && errno == EINTR) {
+            continue;
+        }
+        if(w <= 0) {
+            return false;
+        }
+        done += w;
+    }
+    return true;
+}
+
+// reads up to and without the next newline, lines are short
+bool read_line(int fd, char *buf, size_t len)
+{
+    for(size_t n = 0; n + 1 < len; n++) {
+        if(!read_all(fd, buf + n, 1)) {
+            return false;
+        }
+        if(buf[n] == '\n') {
+            buf[n] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the whole file in a malloc()'d buffer
+char *read_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat statbuf;
+    if(fd < 0 || fstat(fd, &statbuf) != 0) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    char *buf = malloc(statbuf.st_size + 1);
+    if(!read_all(fd, buf, statbuf.st_size)) {
+        free(buf);
+        buf = NULL;
+    }
+    close(fd);
+    *len = statbuf.st_size;
+    return buf;
+}
+
+// unix:<path> or <host>:<port>, fills in the address for a unix socket and
+// returns NULL, otherwise the getaddrinfo() result
+struct addrinfo *parse_addr(const char *addr, struct sockaddr_un *un,
+                            bool listen)
+{
+    memset(un, 0, sizeof(*un));
+    if(strncmp(addr, "unix:", 5) == 0) {
+        un->sun_family = AF_UNIX;
+        if(strlen(addr + 5) >= sizeof(un->sun_path)) {
+            return NULL;
+        }
+        strcpy(un->sun_path, addr + 5);
+        return NULL;
+    }
+    char host[256];
+    const char *colon = strrchr(addr, ':');
+    if(!colon || (size_t)(colon - addr) >= sizeof(host)) {
+        return NULL;
+    }
+    // [::1]:port
+    const char *h = addr;
+    size_t hlen = colon - addr;
+    if(hlen >= 2 && h[0] == '[' && h[hlen - 1] == ']') {
+        h++;
+        hlen -= 2;
+    }
+    memcpy(host, h, hlen);
+    host[hlen] = 0;
+    struct addrinfo hints = { .ai_family = AF_UNSPEC,
+                              .ai_socktype = SOCK_STREAM,
+                              .ai_flags = listen ? AI_PASSIVE : 0 };
+    struct addrinfo *res;
+    if(getaddrinfo(*host ? host : NULL, colon + 1, &hints, &res) != 0) {
+        return NULL;
+    }
+    return res;
+}
+
+// connects with a timeout, a worker that is down should not hold up bake
+int try_connect(int family, const struct sockaddr *sa, socklen_t len)
+{
+    int fd = socket(family, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int r = connect(fd, sa, len);
+    if(r != 0 && errno == EINPROGRESS) {
+        struct pollfd p = { .fd = fd, .events = POLLOUT };
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        bool up = poll(&p, 1, CONNECT_TIMEOUT_MS) == 1 &&
+                  getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 &&
+                  !err;
+        r = up ? 0 : -1;
+    }
+    if(r != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, flags);
+    return fd;
+}
+
+int sock_connect(const char *addr)
+{
+    struct sockaddr_un un;
+    struct addrinfo *res = parse_addr(addr, &un, false);
+    if(un.sun_family == AF_UNIX) {
+        return try_connect(AF_UNIX, (struct sockaddr *)&un, sizeof(un));
+    }
+    int fd = -1;
+    for(struct addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = try_connect(ai->ai_family, ai->ai_addr, ai->ai_addrlen);
+    }
+    if(res) {
+        freeaddrinfo(res);
+    }
+    return fd;
+}
+
+int sock_listen(const char *addr)
+{
+    struct sockaddr_un un;
+    struct addrinfo *res = parse_addr(addr, &un, true);
+    if(!res && un.sun_family != AF_UNIX) {
+        die("cannot use '%s', expected unix:<path> or <host>:<port>", addr);
+    }
+    int fd = socket(res ? res->ai_family : AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        die("socket: %s", strerror(errno));
+    }
+    int one = 1;
+    if(res) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    } else {
+        // a socket left behind by a worker that was killed
+        unlink(un.sun_path);
+    }
+    if(bind(fd, res ? res->ai_addr : (struct sockaddr *)&un,
+            res ? res->ai_addrlen : sizeof(un)) != 0 ||
+       listen(fd, 64) != 0) {
+        die("cannot listen on '%s': %s", addr, strerror(errno));
+    }
+    if(res) {
+        freeaddrinfo(res);
+    }
+    return fd;
+}
+
+// the first line of what cmd prints, without the newline
+void first_line(const char *cmd, char *out, size_t len)
+{
+    *out = 0;
+    FILE *f = popen(cmd, "r");
+    if(!f) {
+        return;
+    }
+    if(fgets(out, len, f)) {
+        out[strcspn(out, "\n")] = 0;
+    }
+    pclose(f);
+}
+
+// the same as bake's cc_identity(), different compilers never match
+void cc_identity(const char *cc, char *out, size_t len)
+{
+    char cmd[PATH_MAX + 64], version[256], machine[128];
+    snprintf(cmd, sizeof(cmd), "'%s' --version 2>/dev/null", cc);
+    first_line(cmd, version, sizeof(version));
+    // gcc starts with the name it was run as
+    const char *base = strrchr(cc, '/');
+    base = base ? base + 1 : cc;
+    size_t blen = strlen(base);
+    char *v = version;
+    if(strncmp(v, base, blen) == 0 && v[blen] == ' ') {
+        v += blen + 1;
+    }
+    snprintf(cmd, sizeof(cmd), "'%s' -dumpmachine 2>/dev/null", cc);
+    first_line(cmd, machine, sizeof(machine));
+    snprintf(out, len, "%s %s", v, machine);
+}
+
+// runs argv in dir, what it prints ends up in *out
+int run(char **argv, const char *dir, char **out, size_t *outlen)
+{
+    int fds[2];
+    if(pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if(pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if(chdir(dir) != 0) {
+            _exit(127);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "bake-worker: cannot run %s: %s\n", argv[0],
+                strerror(errno));
+        _exit(127);
+    }
+    close(fds[1]);
+    size_t cap = 4096;
+    *out = malloc(cap);
+    *outlen = 0;
+    for(;;) {
+        if(*outlen == cap) {
+            cap *= 2;
+            *out = realloc(*out, cap);
+        }
+        ssize_t r = read(fds[0], *out + *outlen, cap - *outlen);
+        if(r < 0 && errno == EINTR) {
+            continue;
+        }
+        if(r <= 0) {
+            break;
+        }
+        *outlen += r;
+    }
+    close(fds[0]);
+    int stat;
+    while(waitpid(pid, &stat, 0) < 0 && errno == EINTR) {
+    }
+    return pid < 0 ? -1 : WIFEXITED(stat) ? WEXITSTATUS(stat) : 128;
+}
+
+// one connection: the greeting, then at most one job
+void serve_conn(int c, const char *cc, int slots, const char *identity)
+{
+    char line[PATH_MAX + 128];
+    int len = snprintf(line, sizeof(line), "bake-worker\t%d\t%d\t%s\n",
+                       PROTO_VERSION, slots, identity);
+    if(!write_all(c, line, len) || !read_line(c, line, sizeof(line))) {
+        // bake only asked who we are
+        return;
+    }
+    // job <flag bytes> <source bytes> <cwd of bake>
+    size_t flaglen, srclen;
+    int cwdoff;
+    if(sscanf(line, "job\t%zu\t%zu\t%n", &flaglen, &srclen, &cwdoff) != 2) {
+        return;
+    }
+    char *flags = malloc(flaglen + 1);
+    char *src = malloc(srclen + 1);
+    if(!read_all(c, flags, flaglen) || !read_all(c, src, srclen)) {
+        return;
+    }
+    flags[flaglen] = 0;
+
+    char dir[] = "/tmp/bake-worker.XXXXXX";
+    if(!mkdtemp(dir)) {
+        return;
+    }
+    char ifile[PATH_MAX], obj[PATH_MAX];
+    snprintf(ifile, PATH_MAX, "%s/in.i", dir);
+    snprintf(obj, PATH_MAX, "%s/out.o", dir);
+    int fd = open(ifile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, src, srclen);
+    if(fd >= 0) {
+        close(fd);
+    }
+    free(src);
+
+    // cc <flags> -fdebug-prefix-map=<dir>=<cwd> -x cpp-output -c in.i -o out.o
+    int nflags = 0;
+    for(size_t i = 0; i < flaglen; i++) {
+        nflags += flags[i] == 0;
+    }
+    char **argv = malloc(sizeof(char *) * (nflags + 9));
+    int argc = 0;
+    argv[argc++] = (char *)cc;
+    for(size_t i = 0; i < flaglen; i += strlen(flags + i) + 1) {
+        argv[argc++] = flags + i;
+    }
+    char prefixmap[PATH_MAX * 2 + 32];
+    snprintf(prefixmap, sizeof(prefixmap), "-fdebug-prefix-map=%s=%s", dir,
+             line + cwdoff);
+    argv[argc++] = prefixmap;
+    argv[argc++] = "-x";
+    argv[argc++] = "cpp-output";
+    argv[argc++] = "-c";
+    argv[argc++] = "in.i";
+    argv[argc++] = "-o";
+    argv[argc++] = "out.o";
+    argv[argc] = NULL;
+
+    char *out = NULL, *objbuf = NULL;
+    size_t outlen = 0, objlen = 0;
+    int status = ok ? run(argv, dir, &out, &outlen) : -1;
+    if(status == 0) {
+        objbuf = read_file(obj, &objlen);
+        status = objbuf ? 0 : -1;
+    }
+    len = snprintf(line, sizeof(line), "done\t%d\t%zu\t%zu\n", status, outlen,
+                   objlen);
+    if(write_all(c, line, len) && write_all(c, out, outlen)) {
+        write_all(c, objbuf, objlen);
+    }
+    unlink(ifile);
+    unlink(obj);
+    rmdir(dir);
+    free(out);
+    free(objbuf);
+    free(argv);
+    free(flags);
+}
+
+void serve(const char *addr, const char *cc, int slots)
+{
+    char identity[512];
+    cc_identity(cc, identity, sizeof(identity));
+    if(strlen(identity) < 3) {
+        die("cannot ask '%s' for its version", cc);
+    }
+    int s = sock_listen(addr);
+    fprintf(stderr, "bake-worker: %d slot(s) on %s, %s\n", slots, addr,
+            identity);
+    // connections being served, every one may run a cc. several bakes
+    // sharing the worker wait in the backlog until a slot is free
+    int running = 0;
+    for(;;) {
+        while(running > 0) {
+            pid_t done = waitpid(-1, NULL, running < slots ? WNOHANG : 0);
+            if(done < 0 && errno == EINTR) {
+                continue;
+            }
+            if(done <= 0) {
+                break;
+            }
+            running--;
+        }
+        int c = accept(s, NULL, NULL);
+        if(c < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            die("accept: %s", strerror(errno));
+        }
+        pid_t pid = fork();
+        if(pid == 0) {
+            close(s);
+            serve_conn(c, cc, slots, identity);
+            _exit(0);
+        }
+        if(pid > 0) {
+            running++;
+        }
+        close(c);
+    }
+}
+
+// bake-worker send <addr> <identity> <ifile> <object> [flags...]
+int send_job(int argc, char **argv)
+{
+    if(argc < 5) {
+        die("usage: bake-worker send <addr> <identity> <ifile> <object> "
+            "[flags...]");
+    }
+    const char *addr = argv[1], *identity = argv[2], *ifile = argv[3],
+               *objpath = argv[4];
+    int c = sock_connect(addr);
+    if(c < 0) {
+        return SEND_UNAVAILABLE;
+    }
+    char line[PATH_MAX + 128];
+    int version, slots, idoff;
+    if(!read_line(c, line, sizeof(line)) ||
+       sscanf(line, "bake-worker\t%d\t%d\t%n", &version, &slots, &idoff) != 2 ||
+       version != PROTO_VERSION || strcmp(line + idoff, identity) != 0) {
+        return SEND_UNAVAILABLE;
+    }
+    size_t srclen;
+    char *src = read_file(ifile, &srclen);
+    if(!src) {
+        return SEND_UNAVAILABLE;
+    }
+    size_t flaglen = 0;
+    for(int i = 5; i < argc; i++) {
+        flaglen += strlen(argv[i]) + 1;
+    }
+    char cwd[PATH_MAX];
+    if(!getcwd(cwd, PATH_MAX)) {
+        strcpy(cwd, ".");
+    }
+    int len = snprintf(line, sizeof(line), "job\t%zu\t%zu\t%s\n", flaglen,
+                       srclen, cwd);
+    bool ok = write_all(c, line, len);
+    for(int i = 5; ok && i < argc; i++) {
+        ok = write_all(c, argv[i], strlen(argv[i]) + 1);
+    }
+    ok = ok && write_all(c, src, srclen);
+    free(src);
+    int status;
+    size_t outlen, objlen;
+    if(!ok || !read_line(c, line, sizeof(line)) ||
+       sscanf(line, "done\t%d\t%zu\t%zu", &status, &outlen, &objlen) != 3 ||
+       status < 0) {
+        return SEND_UNAVAILABLE;
+    }
+    char *out = malloc(outlen + 1);
+    char *obj = malloc(objlen + 1);
+    if(!read_all(c, out, outlen) || !read_all(c, obj, objlen)) {
+        return SEND_UNAVAILABLE;
+    }
+    close(c);
+    write_all(STDERR_FILENO, out, outlen);
+    if(status != 0) {
+        return 1;
+    }
+    // written next to it and renamed, like bake does with its own files
+    char tmp[PATH_MAX];
+    snprintf(tmp, PATH_MAX, "%s.tmp.%d", objpath, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = fd >= 0 && write_all(fd, obj, objlen);
+    ok = fd >= 0 && close(fd) == 0 && ok;
+    if(!ok || rename(tmp, objpath) != 0) {
+        fprintf(stderr, "bake-worker: cannot write %s: %s\n", objpath,
+                strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+    free(out);
+    free(obj);
+    return 0;
+}
+
+void usage()
+{
+    fprintf(stderr,
+            "usage: bake-worker -l <unix:path|host:port> [-c cc] [-j slots]\n"
+            "       bake-worker send <addr> <identity> <ifile> <object> "
+            "[flags...]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN);
+    if(argc > 1 && strcmp(argv[1], "send") == 0) {
+        return send_job(argc - 1, argv + 1);
+    }
+    const char *addr = NULL, *cc = "cc";
+    int slots = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while((opt = getopt(argc, argv, "l:c:j:")) != -1) {
+        switch(opt) {
+        case 'l':
+            addr = optarg;
+            break;
+        case 'c':
+            cc = optarg;
+            break;
+        case 'j':
+            slots = atoi(optarg);
+            if(slots < 1) {
+                usage();
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+    if(!addr || optind != argc) {
+        usage();
+    }
+    if(slots < 1) {
+        slots = 1;
+    }
+    serve(addr, cc, slots);
+    return 0;
+}